@@ -0,0 +1,86 @@
+// 上下文切换开销测试 -> 每次resume/yield往返的耗时(ns)
+#include "../fiber.h"
+
+#include <chrono>
+#include <iostream>
+#include <cstdlib>
+
+using namespace sylar;
+
+static const int LOOPS = 1000000;
+static const size_t STACK_SIZE = 128000;
+
+template <class Context>
+struct PingPong
+{
+	Context main_ctx;
+	Context co_ctx;
+	void* stack = nullptr;
+
+	static void Entry(void* arg)
+	{
+		PingPong* p = (PingPong*)arg;
+		while(true)
+		{
+			// yield
+			Context::Swap(&p->co_ctx, &p->main_ctx);
+		}
+	}
+
+	double run()
+	{
+		stack = malloc(STACK_SIZE);
+		main_ctx.init();
+		co_ctx.make(stack, STACK_SIZE, &PingPong::Entry, this);
+
+		auto start = std::chrono::steady_clock::now();
+		for(int i=0;i<LOOPS;i++)
+		{
+			// resume
+			Context::Swap(&main_ctx, &co_ctx);
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		// 协程停在Swap中 -> 栈可以直接释放
+		free(stack);
+		return std::chrono::duration<double, std::nano>(end - start).count() / LOOPS;
+	}
+};
+
+static double bench_fiber()
+{
+	Fiber::GetThis();
+	std::shared_ptr<Fiber> fiber = std::make_shared<Fiber>([]()
+	{
+		while(true)
+		{
+			Fiber::GetThis()->yield();
+		}
+	}, 0, false);
+
+	auto start = std::chrono::steady_clock::now();
+	for(int i=0;i<LOOPS;i++)
+	{
+		fiber->resume();
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count() / LOOPS;
+}
+
+int main()
+{
+#if defined(__x86_64__) || defined(__aarch64__)
+	PingPong<AsmContext> asm_pp;
+	std::cout << "AsmContext      : " << asm_pp.run() << " ns per resume/yield" << std::endl;
+#endif
+	PingPong<UContext> uc_pp;
+	std::cout << "UContext        : " << uc_pp.run() << " ns per resume/yield" << std::endl;
+
+#if defined(SYLAR_FIBER_UCONTEXT) || !(defined(__x86_64__) || defined(__aarch64__))
+	std::cout << "Fiber(ucontext): ";
+#else
+	std::cout << "Fiber(asm)     : ";
+#endif
+	std::cout << bench_fiber() << " ns per resume/yield" << std::endl;
+	return 0;
+}
@@ -0,0 +1,153 @@
+// TCP回显吞吐量 -> epoll / 分片epoll / io_uring 以及常驻注册的epoll
+// 同一进程内 每个连接一个客户端协程和一个服务端协程 往返发送固定大小的消息
+#include "../ioscheduler.h"
+#include "../hook.h"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+using namespace sylar;
+
+static const size_t MSG_SIZE = 64;
+
+static std::atomic<long> s_roundTrips{0};
+static std::atomic<bool> s_running{true};
+
+static void Serve(int fd)
+{
+	// 服务端一次读尽可能多 -> 读不满说明已读空 下一次recv直接挂起
+	char buf[4096];
+	while(true)
+	{
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if(n <= 0 || send(fd, buf, n, 0) != n)
+		{
+			break;
+		}
+	}
+	close(fd);
+}
+
+static void Client(sockaddr_in addr)
+{
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if(connect(fd, (sockaddr*)&addr, sizeof(addr)))
+	{
+		perror("connect");
+		close(fd);
+		return;
+	}
+
+	char buf[MSG_SIZE] = {0};
+	while(s_running)
+	{
+		if(send(fd, buf, sizeof(buf), 0) != (ssize_t)sizeof(buf))
+		{
+			break;
+		}
+		size_t got = 0;
+		while(got < sizeof(buf))
+		{
+			ssize_t n = recv(fd, buf + got, sizeof(buf) - got, 0);
+			if(n <= 0)
+			{
+				break;
+			}
+			got += n;
+		}
+		s_roundTrips++;
+	}
+	close(fd);
+}
+
+static void RunReactor(const std::string& name, IOManager::Reactor reactor, bool persistent, int threads, int conns, int ms)
+{
+	IOManager iom(threads, false, name, Scheduler::SHARED_QUEUE, reactor);
+	iom.setPersistentEvents(persistent);
+	if(iom.getReactor() != reactor)
+	{
+		std::cout << name << ": not available" << std::endl;
+		return;
+	}
+
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t len = sizeof(addr);
+	if(bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) || listen(listen_fd, 1024) || getsockname(listen_fd, (sockaddr*)&addr, &len))
+	{
+		perror("listen");
+		exit(1);
+	}
+
+	// 接受连接的协程 -> 收到conns个连接后退出
+	iom.scheduleLock([listen_fd, conns]()
+	{
+		for(int i=0;i<conns;i++)
+		{
+			int fd = accept(listen_fd, nullptr, nullptr);
+			if(fd < 0)
+			{
+				break;
+			}
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			IOManager::GetThis()->scheduleLock([fd](){Serve(fd);});
+		}
+		close(listen_fd);
+	});
+
+	for(int i=0;i<conns;i++)
+	{
+		iom.scheduleLock([addr](){Client(addr);});
+	}
+
+	usleep(ms * 1000 / 10);
+	long start = s_roundTrips;
+	uint64_t skipped_start = get_skipped_syscalls();
+	usleep(ms * 1000);
+	long end = s_roundTrips;
+	uint64_t skipped_end = get_skipped_syscalls();
+	s_running = false;
+
+	std::cout << name << ": " << (end - start) * 1000 / ms << " round trips/s, " 
+		<< (skipped_end - skipped_start) * 1000 / ms << " syscalls skipped/s" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int threads = argc > 1 ? atoi(argv[1]) : 2;
+	int conns = argc > 2 ? atoi(argv[2]) : 64;
+	int ms = argc > 3 ? atoi(argv[3]) : 2000;
+
+	// 每种模式在独立的子进程中测试 -> 互不影响
+	struct Mode {const char* name; IOManager::Reactor reactor; bool persistent;};
+	Mode modes[] = {
+		{"epoll", IOManager::EPOLL, false}, 
+		{"epoll persistent", IOManager::EPOLL, true}, 
+		{"sharded epoll", IOManager::SHARDED_EPOLL, false}, 
+		{"sharded epoll persistent", IOManager::SHARDED_EPOLL, true}, 
+		{"io_uring", IOManager::IO_URING, false}
+	};
+	for(const Mode& mode : modes)
+	{
+		pid_t pid = fork();
+		if(pid == 0)
+		{
+			RunReactor(mode.name, mode.reactor, mode.persistent, threads, conns, ms);
+			return 0;
+		}
+		waitpid(pid, nullptr, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,157 @@
+// IOManager的fd表 -> 分块两级表 vs shared_mutex+vector<FdContext*>(原contextResize的实现)
+// N个线程同时注册各自的fd(交错分配 -> 表在注册过程中不断增长) 然后随机查找
+// 只测表本身 不调用epoll_ctl -> 不受进程fd上限限制
+#include "../chunked_table.h"
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+
+using namespace sylar;
+
+// 与FdContext相同的访问方式 -> 找到后加锁修改
+struct Slot
+{
+	std::mutex mutex;
+	int fd = 0;
+	int events = 0;
+};
+
+struct alignas(64) AlignedSlot
+{
+	std::mutex mutex;
+	int fd = 0;
+	int events = 0;
+};
+
+struct VectorTable
+{
+	std::shared_mutex mutex;
+	std::vector<Slot*> slots;
+
+	VectorTable() {resize(32);}
+
+	~VectorTable()
+	{
+		for(Slot* slot : slots)
+		{
+			delete slot;
+		}
+	}
+
+	void resize(size_t size)
+	{
+		slots.resize(size);
+		for(size_t i=0;i<slots.size();i++)
+		{
+			if(slots[i]==nullptr)
+			{
+				slots[i] = new Slot();
+				slots[i]->fd = i;
+			}
+		}
+	}
+
+	Slot* getOrCreate(int fd)
+	{
+		std::shared_lock<std::shared_mutex> read_lock(mutex);
+		if((int)slots.size() > fd)
+		{
+			return slots[fd];
+		}
+		read_lock.unlock();
+		std::unique_lock<std::shared_mutex> write_lock(mutex);
+		if((int)slots.size() <= fd)
+		{
+			resize(fd * 1.5);
+		}
+		return slots[fd];
+	}
+
+	Slot* get(int fd)
+	{
+		std::shared_lock<std::shared_mutex> read_lock(mutex);
+		return (int)slots.size() > fd ? slots[fd] : nullptr;
+	}
+};
+
+struct ChunkTable
+{
+	ChunkedTable<AlignedSlot> table{[](AlignedSlot& slot, size_t fd){slot.fd = fd;}};
+
+	AlignedSlot* getOrCreate(int fd) {return table.getOrCreate(fd);}
+	AlignedSlot* get(int fd) {return table.get(fd);}
+};
+
+template <class Table>
+static void Run(const char* name, int threads, int fds, long lookups)
+{
+	Table table;
+	std::vector<std::thread> workers;
+
+	// 1 所有线程同时注册
+	auto start = std::chrono::steady_clock::now();
+	for(int t=0;t<threads;t++)
+	{
+		workers.emplace_back([&, t]()
+		{
+			for(int fd=t;fd<fds;fd+=threads)
+			{
+				auto slot = table.getOrCreate(fd);
+				std::lock_guard<std::mutex> lock(slot->mutex);
+				slot->events |= 1;
+			}
+		});
+	}
+	for(auto& w : workers)
+	{
+		w.join();
+	}
+	workers.clear();
+	auto mid = std::chrono::steady_clock::now();
+
+	// 2 所有线程同时随机查找
+	std::atomic<long> found{0};
+	for(int t=0;t<threads;t++)
+	{
+		workers.emplace_back([&, t]()
+		{
+			std::mt19937 rng(t);
+			long n = 0;
+			for(long i=0;i<lookups;i++)
+			{
+				auto slot = table.get(rng() % fds);
+				std::lock_guard<std::mutex> lock(slot->mutex);
+				n += slot->events;
+			}
+			found += n;
+		});
+	}
+	for(auto& w : workers)
+	{
+		w.join();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double register_ms = std::chrono::duration<double, std::milli>(mid - start).count();
+	double lookup_s = std::chrono::duration<double>(end - mid).count();
+	std::cout << name << ": register " << fds << " fds " << register_ms << " ms, "
+		<< threads * lookups / lookup_s / 1e6 << " M lookups/s"
+		<< (found == threads * lookups ? "" : " (mismatch)") << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int threads = argc > 1 ? atoi(argv[1]) : 4;
+	int fds = argc > 2 ? atoi(argv[2]) : 500000;
+	long lookups = argc > 3 ? atol(argv[3]) : 2000000;
+
+	Run<VectorTable>("shared_mutex + vector", threads, fds, lookups);
+	Run<ChunkTable>("chunked table", threads, fds, lookups);
+	return 0;
+}
@@ -0,0 +1,145 @@
+// hook每次调用的额外开销
+// 1 fd查找 -> FdMgr::get() vs 原实现(Singleton互斥锁 + shared_mutex + 拷贝shared_ptr) 多线程同时查找
+// 2 socketpair乒乓 -> 同一协程内send一个字节再recv回来 数据总是就绪 不会挂起 hook版本与原函数的耗时差即hook开销
+#include "../ioscheduler.h"
+#include "../fd_manager.h"
+#include "../hook.h"
+
+#include <sys/socket.h>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+
+using namespace sylar;
+
+// 原FdManager的查找路径
+struct OldFdManager
+{
+	std::shared_mutex mutex;
+	std::vector<std::shared_ptr<FdCtx>> datas;
+
+	static OldFdManager* GetInstance()
+	{
+		static std::mutex s_mutex;
+		static OldFdManager* s_instance = nullptr;
+		std::lock_guard<std::mutex> lock(s_mutex);
+		if(s_instance == nullptr)
+		{
+			s_instance = new OldFdManager();
+		}
+		return s_instance;
+	}
+
+	std::shared_ptr<FdCtx> get(int fd)
+	{
+		std::shared_lock<std::shared_mutex> read_lock(mutex);
+		return (int)datas.size() > fd ? datas[fd] : nullptr;
+	}
+};
+
+template <class Lookup>
+static double RunLookup(int threads, int fds, long lookups, Lookup lookup)
+{
+	std::vector<std::thread> workers;
+	std::atomic<long> found{0};
+	auto start = std::chrono::steady_clock::now();
+	for(int t=0;t<threads;t++)
+	{
+		workers.emplace_back([&, t]()
+		{
+			std::mt19937 rng(t);
+			long n = 0;
+			for(long i=0;i<lookups;i++)
+			{
+				n += lookup(rng() % fds);
+			}
+			found += n;
+		});
+	}
+	for(auto& w : workers)
+	{
+		w.join();
+	}
+	double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return s * 1e9 / (threads * lookups);
+}
+
+int main(int argc, char* argv[])
+{
+	int threads = argc > 1 ? atoi(argv[1]) : 4;
+	long lookups = argc > 2 ? atol(argv[2]) : 2000000;
+	long rounds = argc > 3 ? atol(argv[3]) : 200000;
+
+	// 1 fd查找 -> 两种实现登记同样的fd
+	const int FDS = 1024;
+	OldFdManager* old_mgr = OldFdManager::GetInstance();
+	old_mgr->datas.resize(FDS);
+	for(int fd=0;fd<FDS;fd++)
+	{
+		old_mgr->datas[fd] = std::make_shared<FdCtx>(-1);
+		FdMgr::GetInstance()->get(fd, true);
+	}
+	double old_ns = RunLookup(threads, FDS, lookups, [](int fd)
+	{
+		return OldFdManager::GetInstance()->get(fd) ? 1 : 0;
+	});
+	double new_ns = RunLookup(threads, FDS, lookups, [](int fd)
+	{
+		return FdMgr::GetInstance()->get(fd) ? 1 : 0;
+	});
+	std::cout << "fd lookup (" << threads << " threads): mutex + shared_ptr " << old_ns << " ns, lock-free " << new_ns << " ns" << std::endl;
+
+	// 2 socketpair乒乓
+	double raw_ns = 0;
+	double hooked_ns = 0;
+	{
+		IOManager iom(1, false);
+		std::atomic<bool> finished{false};
+		iom.scheduleLock([&]()
+		{
+			int sv[2];
+			socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+			FdMgr::GetInstance()->get(sv[0], true);
+			FdMgr::GetInstance()->get(sv[1], true);
+			char c = 'x';
+
+			// 预热
+			for(long i=0;i<rounds;i++)
+			{
+				send(sv[0], &c, 1, 0);
+				recv(sv[1], &c, 1, 0);
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			for(long i=0;i<rounds;i++)
+			{
+				send_f(sv[0], &c, 1, 0);
+				recv_f(sv[1], &c, 1, 0);
+			}
+			auto mid = std::chrono::steady_clock::now();
+			for(long i=0;i<rounds;i++)
+			{
+				send(sv[0], &c, 1, 0);
+				recv(sv[1], &c, 1, 0);
+			}
+			auto end = std::chrono::steady_clock::now();
+
+			raw_ns = std::chrono::duration<double, std::nano>(mid - start).count() / (rounds * 2);
+			hooked_ns = std::chrono::duration<double, std::nano>(end - mid).count() / (rounds * 2);
+			close(sv[0]);
+			close(sv[1]);
+			finished = true;
+		});
+		while(!finished)
+		{
+			usleep(1000);
+		}
+	}
+	std::cout << "socketpair send/recv: original " << raw_ns << " ns/call, hooked " << hooked_ns << " ns/call, overhead " << hooked_ns - raw_ns << " ns/call" << std::endl;
+	return 0;
+}
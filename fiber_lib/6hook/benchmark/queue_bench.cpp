@@ -0,0 +1,106 @@
+// 任务队列竞争测试 -> N个生产者 M个消费者
+// 无锁MPMC队列 vs 互斥锁+vector(原scheduleLock/run的路径)
+// 积压任务数限制在BACKLOG以内 -> 模拟调度器的稳态负载 也避免vector头部删除退化为O(n^2)
+#include "../mpmc_queue.h"
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+
+using namespace sylar;
+
+typedef std::function<void()> Task;
+
+static const long BACKLOG = 1024;
+
+struct MutexVectorQueue
+{
+	std::mutex mutex;
+	std::vector<Task> tasks;
+
+	void push(Task&& task)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(std::move(task));
+	}
+
+	bool tryPop(Task& task)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(tasks.empty())
+		{
+			return false;
+		}
+		task = std::move(tasks.front());
+		tasks.erase(tasks.begin());
+		return true;
+	}
+};
+
+template <class Queue>
+static double Run(int producers, int consumers, long items)
+{
+	Queue queue;
+	std::atomic<long> produced{0};
+	std::atomic<long> consumed{0};
+	std::atomic<long> sum{0};
+	std::vector<std::thread> threads;
+
+	auto start = std::chrono::steady_clock::now();
+	for(int p=0;p<producers;p++)
+	{
+		threads.emplace_back([&, p]()
+		{
+			for(long i=p;i<items;i+=producers)
+			{
+				while(produced - consumed > BACKLOG)
+				{
+					std::this_thread::yield();
+				}
+				produced++;
+				queue.push([&sum, i](){sum += i;});
+			}
+		});
+	}
+	for(int c=0;c<consumers;c++)
+	{
+		threads.emplace_back([&]()
+		{
+			Task task;
+			while(consumed < items)
+			{
+				if(queue.tryPop(task))
+				{
+					task();
+					consumed++;
+				}
+			}
+		});
+	}
+	for(auto& t : threads)
+	{
+		t.join();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	if(sum != items * (items - 1) / 2)
+	{
+		std::cerr << "lost tasks" << std::endl;
+	}
+	return items / std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+	int producers = argc > 1 ? atoi(argv[1]) : 4;
+	int consumers = argc > 2 ? atoi(argv[2]) : 4;
+	long items = argc > 3 ? atol(argv[3]) : 2000000;
+
+	std::cout << producers << " producers, " << consumers << " consumers, " << items << " tasks" << std::endl;
+	std::cout << "mutex + vector : " << (long)Run<MutexVectorQueue>(producers, consumers, items) << " tasks/s" << std::endl;
+	std::cout << "lock-free MPMC : " << (long)Run<UnboundedMPMCQueue<Task>>(producers, consumers, items) << " tasks/s" << std::endl;
+	return 0;
+}
@@ -0,0 +1,58 @@
+// 短回调任务吞吐量 -> 每个回调任务新建协程 / 复用已结束的协程
+#include "../scheduler.h"
+
+#include <chrono>
+#include <iostream>
+#include <cstdlib>
+
+using namespace sylar;
+
+// 并发的任务链数 -> 每个回调在结束前调度下一个回调
+static const int CHAINS = 64;
+
+static Scheduler* s_scheduler = nullptr;
+static long s_remaining[CHAINS];
+
+static void Step(int chain)
+{
+	if(--s_remaining[chain] > 0)
+	{
+		s_scheduler->scheduleLock([chain](){Step(chain);});
+	}
+}
+
+static double Run(bool recycle, long tasks)
+{
+	Scheduler scheduler(1, true, recycle ? "recycle" : "no_recycle");
+	scheduler.setRecycleFibers(recycle);
+	s_scheduler = &scheduler;
+	scheduler.start();
+
+	for(int i=0;i<CHAINS;i++)
+	{
+		s_remaining[i] = tasks / CHAINS;
+		scheduler.scheduleLock([i](){Step(i);});
+	}
+
+	// use_caller -> 任务在stop()中执行
+	auto start = std::chrono::steady_clock::now();
+	scheduler.stop();
+	auto end = std::chrono::steady_clock::now();
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	return tasks / seconds;
+}
+
+int main(int argc, char* argv[])
+{
+	long tasks = argc > 1 ? atol(argv[1]) : 1000000;
+
+	double before = Run(false, tasks);
+	double after = Run(true, tasks);
+	std::cout << "new fiber per task : " << (long)before << " tasks/s" << std::endl;
+	std::cout << "recycled fiber     : " << (long)after << " tasks/s" << std::endl;
+
+	StackAllocator::Stats stats = StackAllocator::GetStats();
+	std::cout << "stack allocator    : hits = " << stats.hits << ", misses = " << stats.misses << std::endl;
+	return 0;
+}
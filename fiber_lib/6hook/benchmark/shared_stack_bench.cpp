@@ -0,0 +1,110 @@
+// 每个挂起连接的内存占用 -> 独立栈(malloc) / 独立栈(mmap) / 共享栈
+// 每个连接一个协程 阻塞在hook后的recv上
+#include "../ioscheduler.h"
+#include "../fd_manager.h"
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+using namespace sylar;
+
+static std::atomic<int> s_parked{0};
+static std::atomic<int> s_finished{0};
+
+static long ResidentBytes()
+{
+	long pages = 0, resident = 0;
+	std::ifstream statm("/proc/self/statm");
+	statm >> pages >> resident;
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void WaitFor(std::atomic<int>& counter, int n)
+{
+	while(counter < n)
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+static void RunMode(const std::string& mode, int conns)
+{
+	bool shared = mode == "shared";
+	if(mode == "mmap")
+	{
+		StackAllocator::SetDefaultType(StackAllocator::MMAP_STACK);
+	}
+
+	std::vector<int> fds(conns * 2);
+	for(int i=0;i<conns;i++)
+	{
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, &fds[i * 2]))
+		{
+			perror("socketpair");
+			exit(1);
+		}
+		FdMgr::GetInstance()->get(fds[i * 2], true);
+	}
+
+	// 调用线程只在stop()时参与调度 -> 协程都运行在唯一的工作线程上
+	IOManager iom(2);
+	long before = ResidentBytes();
+
+	for(int i=0;i<conns;i++)
+	{
+		int fd = fds[i * 2];
+		iom.scheduleLock(std::make_shared<Fiber>([fd]()
+		{
+			char buf[256];
+			s_parked++;
+			recv(fd, buf, sizeof(buf), 0);
+			s_finished++;
+		}, 0, true, shared));
+	}
+	WaitFor(s_parked, conns);
+
+	long after = ResidentBytes();
+	std::cout << mode << ": " << (after - before) / conns << " bytes per parked connection" << std::endl;
+
+	for(int i=0;i<conns;i++)
+	{
+		write(fds[i * 2 + 1], "x", 1);
+	}
+	WaitFor(s_finished, conns);
+	for(int fd : fds)
+	{
+		close(fd);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	int conns = argc > 1 ? atoi(argv[1]) : 5000;
+
+	struct rlimit rl;
+	getrlimit(RLIMIT_NOFILE, &rl);
+	rl.rlim_cur = rl.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &rl);
+
+	// 每种模式在独立的子进程中测试 -> 互不影响
+	const char* modes[] = {"malloc", "mmap", "shared"};
+	for(const char* mode : modes)
+	{
+		pid_t pid = fork();
+		if(pid == 0)
+		{
+			RunMode(mode, conns);
+			return 0;
+		}
+		waitpid(pid, nullptr, 0);
+	}
+	return 0;
+}
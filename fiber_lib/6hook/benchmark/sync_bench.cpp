@@ -0,0 +1,80 @@
+// 协程互斥锁 -> FiberMutex vs std::mutex
+// N个协程争抢同一把锁 临界区忙等几微秒 之后再提交与锁无关的协程 记录它们多久才能跑完
+// std::mutex等待时阻塞整个工作线程 -> 线程上的其他协程也跟着停下 FiberMutex只挂起等待的协程
+#include "../ioscheduler.h"
+#include "../fiber_sync.h"
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <cstdlib>
+
+using namespace sylar;
+
+static void Spin(int us)
+{
+	auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(us);
+	while(std::chrono::steady_clock::now() < end);
+}
+
+template <class Mutex>
+static void Run(const char* name, int threads, int fibers, long ops, int hold_us)
+{
+	Mutex mutex;
+	long counter = 0;
+	WaitGroup contenders;
+	contenders.add(fibers);
+	// 与锁无关的协程 -> 每个工作线程一个 各自忙等10ms
+	WaitGroup independent;
+	independent.add(threads);
+
+	auto start = std::chrono::steady_clock::now();
+	double lock_s = 0;
+	double independent_ms = 0;
+	{
+		IOManager iom(threads, false);
+		for(int f=0;f<fibers;f++)
+		{
+			iom.scheduleLock([&]()
+			{
+				for(long i=0;i<ops;i++)
+				{
+					std::lock_guard<Mutex> lock(mutex);
+					Spin(hold_us);
+					counter++;
+				}
+				contenders.done();
+			});
+		}
+		for(int t=0;t<threads;t++)
+		{
+			iom.scheduleLock([&]()
+			{
+				Spin(10000);
+				independent.done();
+			});
+		}
+
+		// 主线程不是协程 -> WaitGroup阻塞线程等待
+		independent.wait();
+		independent_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		contenders.wait();
+		lock_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	std::cout << name << " (" << threads << " threads, " << fibers << " fibers): " << lock_s * 1e9 / (fibers * ops) << " ns/lock, "
+		<< "independent fibers done after " << independent_ms << " ms"
+		<< (counter == fibers * ops ? "" : " (mismatch)") << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int threads = argc > 1 ? atoi(argv[1]) : 4;
+	int fibers = argc > 2 ? atoi(argv[2]) : 64;
+	long ops = argc > 3 ? atol(argv[3]) : 2000;
+	int hold_us = argc > 4 ? atoi(argv[4]) : 5;
+
+	Run<std::mutex>("std::mutex", threads, fibers, ops, hold_us);
+	Run<FiberMutex>("FiberMutex", threads, fibers, ops, hold_us);
+	return 0;
+}
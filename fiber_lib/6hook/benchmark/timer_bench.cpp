@@ -0,0 +1,222 @@
+// 定时器 -> 分层时间轮(TimerManager) vs 有序set(原实现)
+// 先插入N个随机超时的定时器并保持不到期 再在此基础上反复添加并取消 -> 模拟do_io中带超时的读写
+// 多线程同时添加并取消 -> 全局锁(原实现) vs 每线程一个分片
+// do_io的超时 -> 条件timer(shared_ptr + std::bind + weak_ptr) vs 对象池 + 内联回调
+#include "../timer.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+
+using namespace sylar;
+
+// 原TimerManager的数据结构 -> shared_ptr按到期时间排序放在set中
+struct SetTimer
+{
+	std::chrono::time_point<std::chrono::system_clock> next;
+	std::function<void()> cb;
+};
+
+struct SetComparator
+{
+	bool operator()(const std::shared_ptr<SetTimer>& lhs, const std::shared_ptr<SetTimer>& rhs) const
+	{
+		return lhs->next < rhs->next;
+	}
+};
+
+struct SetTimerManager
+{
+	std::shared_mutex mutex;
+	std::set<std::shared_ptr<SetTimer>, SetComparator> timers;
+
+	std::shared_ptr<SetTimer> addTimer(uint64_t ms, std::function<void()> cb)
+	{
+		std::shared_ptr<SetTimer> timer(new SetTimer());
+		timer->next = std::chrono::system_clock::now() + std::chrono::milliseconds(ms);
+		timer->cb = cb;
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		timers.insert(timer);
+		return timer;
+	}
+
+	void cancel(const std::shared_ptr<SetTimer>& timer)
+	{
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		auto it = timers.find(timer);
+		if(it != timers.end())
+		{
+			timers.erase(it);
+		}
+	}
+};
+
+struct WheelTimerManager
+{
+	TimerManager manager;
+
+	std::shared_ptr<Timer> addTimer(uint64_t ms, std::function<void()> cb) {return manager.addTimer(ms, cb);}
+	void cancel(const std::shared_ptr<Timer>& timer) {timer->cancel();}
+};
+
+// 多线程测试中当前线程的编号
+static thread_local int t_index = -1;
+
+// 所有线程共用一个分片 -> 外面加一把全局锁 与原TimerManager的m_mutex相同
+struct LockedTimerManager
+{
+	std::mutex mutex;
+	TimerManager manager;
+
+	void addAndCancel(std::function<void()> cb)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		manager.addTimer(5000, cb)->cancel();
+	}
+};
+
+// 每个线程一个分片 -> 与IOManager的工作线程相同
+struct ShardedTimerManager
+{
+	struct Manager : public TimerManager
+	{
+		Manager(size_t shards) : TimerManager(shards) {}
+		int getTimerShard() override {return t_index;}
+	};
+	Manager manager;
+
+	ShardedTimerManager(int threads) : manager(threads) {}
+
+	void addAndCancel(std::function<void()> cb) {manager.addTimer(5000, cb)->cancel();}
+};
+
+static double NsPerOp(std::chrono::steady_clock::time_point start, long ops)
+{
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / ops;
+}
+
+template <class Manager>
+static void Run(const char* name, long outstanding, long ops)
+{
+	Manager manager;
+	std::mt19937 rng(1);
+	auto cb = [](){};
+
+	// 1 插入outstanding个10秒到10分钟的定时器
+	std::vector<decltype(manager.addTimer(0, cb))> timers;
+	timers.reserve(outstanding);
+	auto start = std::chrono::steady_clock::now();
+	for(long i=0;i<outstanding;i++)
+	{
+		timers.push_back(manager.addTimer(10000 + rng() % 590000, cb));
+	}
+	double insert_ns = NsPerOp(start, outstanding);
+
+	// 2 添加后立即取消 -> 读写在超时前完成
+	start = std::chrono::steady_clock::now();
+	for(long i=0;i<ops;i++)
+	{
+		auto timer = manager.addTimer(5000, cb);
+		manager.cancel(timer);
+	}
+	double churn_ns = NsPerOp(start, ops);
+
+	// 3 取消全部
+	start = std::chrono::steady_clock::now();
+	for(auto& timer : timers)
+	{
+		manager.cancel(timer);
+	}
+	double cancel_ns = NsPerOp(start, outstanding);
+
+	std::cout << name << ": insert " << insert_ns << " ns, add+cancel with " << outstanding << " outstanding " << churn_ns
+		<< " ns, cancel " << cancel_ns << " ns" << std::endl;
+}
+
+template <class Manager>
+static void Contend(const char* name, Manager& manager, int threads, long ops)
+{
+	auto cb = [](){};
+	std::vector<std::thread> workers;
+	auto start = std::chrono::steady_clock::now();
+	for(int t=0;t<threads;t++)
+	{
+		workers.emplace_back([&, t]()
+		{
+			t_index = t;
+			for(long i=0;i<ops;i++)
+			{
+				manager.addAndCancel(cb);
+			}
+		});
+	}
+	for(auto& w : workers)
+	{
+		w.join();
+	}
+	double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << name << " (" << threads << " threads): " << threads * ops / s / 1e6 << " M add+cancel/s" << std::endl;
+}
+
+// 与do_io相同 -> 添加一个带超时的等待 数据在超时前到达后取消
+static void IoTimeout(long ops)
+{
+	TimerManager manager;
+	int fd = 3;
+	int event = 1;
+
+	auto start = std::chrono::steady_clock::now();
+	for(long i=0;i<ops;i++)
+	{
+		std::shared_ptr<int> tinfo(new int(0));
+		std::weak_ptr<int> winfo(tinfo);
+		auto timer = manager.addConditionTimer(5000, [winfo, fd, event]()
+		{
+			auto t = winfo.lock();
+			if(t)
+			{
+				*t = fd + event;
+			}
+		}, winfo);
+		timer->cancel();
+	}
+	double condition_ns = NsPerOp(start, ops);
+
+	start = std::chrono::steady_clock::now();
+	for(long i=0;i<ops;i++)
+	{
+		int cancelled = 0;
+		TimerHandle timer = manager.addInlineTimer(std::chrono::milliseconds(5000), [&cancelled, fd, event]()
+		{
+			cancelled = fd + event;
+		});
+		timer.cancel();
+	}
+	double inline_ns = NsPerOp(start, ops);
+
+	std::cout << "io timeout add+cancel: condition timer " << condition_ns << " ns, inline timer " << inline_ns << " ns" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	long outstanding = argc > 1 ? atol(argv[1]) : 1000000;
+	long ops = argc > 2 ? atol(argv[2]) : 1000000;
+	int threads = argc > 3 ? atoi(argv[3]) : 4;
+
+	Run<SetTimerManager>("set", outstanding, ops);
+	Run<WheelTimerManager>("timing wheel", outstanding, ops);
+
+	LockedTimerManager locked;
+	Contend("global lock", locked, threads, ops);
+	ShardedTimerManager sharded(threads);
+	Contend("per-thread shards", sharded, threads, ops);
+
+	IoTimeout(ops);
+	return 0;
+}
@@ -0,0 +1,69 @@
+// 唤醒测试 -> 工作线程全部空闲时外部提交一批任务 统计唤醒延迟和有效唤醒比例
+// 一半任务指定线程 -> 只应唤醒目标线程
+#include "../ioscheduler.h"
+
+#include <chrono>
+#include <iostream>
+#include <cstdlib>
+#include <set>
+
+using namespace sylar;
+
+static const int THREADS = 4;
+
+int main(int argc, char* argv[])
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 1000;
+	int batch = argc > 2 ? atoi(argv[2]) : 2;
+
+	std::atomic<long> done{0};
+	std::atomic<long> latency{0};
+	std::mutex mutex;
+	std::set<int> ids;
+	{
+		IOManager iom(THREADS, false, "wakeup");
+
+		// 记录工作线程的id
+		for(int i=0;i<THREADS*4;i++)
+		{
+			iom.scheduleLock([&mutex, &ids]()
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				ids.insert(Thread::GetThreadId());
+			});
+		}
+		usleep(100000);
+		std::vector<int> threads;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			threads.assign(ids.begin(), ids.end());
+		}
+
+		for(int r=0;r<rounds;r++)
+		{
+			long target = done + batch;
+			for(int i=0;i<batch;i++)
+			{
+				auto start = std::chrono::steady_clock::now();
+				auto cb = [&done, &latency, start]()
+				{
+					latency += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+					done++;
+				};
+				int thread = threads[r % threads.size()];
+				iom.scheduleLock(cb, i % 2 ? thread : -1);
+			}
+			while(done < target)
+			{
+				usleep(10);
+			}
+			// 让工作线程重新进入空闲
+			usleep(1000);
+		}
+
+		Scheduler::WakeupStats stats = iom.getWakeupStats();
+		std::cout << "tasks = " << done << ", avg latency = " << latency / done << " us" << std::endl;
+		std::cout << "wakeups sent = " << stats.sent << ", useful = " << stats.useful << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,268 @@
+#include "channel.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace sylar {
+
+void ChannelBase::close()
+{
+	FiberWaitQueue woken;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_closed)
+		{
+			return;
+		}
+		m_closed = true;
+
+		// result保持0 -> 等待方知道是因为关闭而返回
+		ChannelWaiter* waiter;
+		while((waiter = PopWaiter(m_recvq)))
+		{
+			woken.push(waiter);
+		}
+		while((waiter = PopWaiter(m_sendq)))
+		{
+			woken.push(waiter);
+		}
+	}
+	FiberWaitQueue::WakeAll(woken.popAll());
+}
+
+bool ChannelBase::isClosed()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_closed;
+}
+
+ChannelWaiter* ChannelBase::PopWaiter(FiberWaitQueue& queue)
+{
+	while(FiberWaiter* waiter = queue.pop())
+	{
+		ChannelWaiter* cw = static_cast<ChannelWaiter*>(waiter);
+		int expected = -1;
+		if(!cw->selected || cw->selected->compare_exchange_strong(expected, cw->index))
+		{
+			return cw;
+		}
+	}
+	return nullptr;
+}
+
+bool ChannelBase::send(void* value)
+{
+	ChannelWaiter* woken = nullptr;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	Result result = trySendLocked(value, woken);
+	if(result != BLOCKED)
+	{
+		lock.unlock();
+		if(woken)
+		{
+			FiberWaitQueue::Wake(woken);
+		}
+		return result == DONE;
+	}
+
+	// 接收方取走后把result置1
+	OffStack<ChannelWaiter> waiter;
+	waiter->value = waitValue(value);
+	m_sendq.wait(*waiter, lock);
+	if(waiter->value != value)
+	{
+		unboxValue(waiter->value, value);
+	}
+	return waiter->result == 1;
+}
+
+bool ChannelBase::trySend(void* value)
+{
+	ChannelWaiter* woken = nullptr;
+	Result result;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		result = trySendLocked(value, woken);
+	}
+	if(woken)
+	{
+		FiberWaitQueue::Wake(woken);
+	}
+	return result == DONE;
+}
+
+bool ChannelBase::recv(void* value)
+{
+	ChannelWaiter* woken = nullptr;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	Result result = tryRecvLocked(value, woken);
+	if(result != BLOCKED)
+	{
+		lock.unlock();
+		if(woken)
+		{
+			FiberWaitQueue::Wake(woken);
+		}
+		return result == DONE;
+	}
+
+	// 发送方放入值后把result置1
+	OffStack<ChannelWaiter> waiter;
+	waiter->value = waitValue(value);
+	m_recvq.wait(*waiter, lock);
+	if(waiter->value != value)
+	{
+		unboxValue(waiter->value, value);
+	}
+	return waiter->result == 1;
+}
+
+bool ChannelBase::tryRecv(void* value)
+{
+	ChannelWaiter* woken = nullptr;
+	Result result;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		result = tryRecvLocked(value, woken);
+	}
+	if(woken)
+	{
+		FiberWaitQueue::Wake(woken);
+	}
+	return result == DONE;
+}
+
+Select& Select::add(ChannelBase* channel, void* value, bool send)
+{
+	Case c;
+	c.channel = channel;
+	c.value = value;
+	c.send = send;
+	m_cases.push_back(std::move(c));
+	return *this;
+}
+
+void Select::lockAll()
+{
+	if(m_locked.empty())
+	{
+		for(auto& c : m_cases)
+		{
+			m_locked.push_back(c.channel);
+		}
+		std::sort(m_locked.begin(), m_locked.end());
+		m_locked.erase(std::unique(m_locked.begin(), m_locked.end()), m_locked.end());
+	}
+	for(ChannelBase* channel : m_locked)
+	{
+		channel->m_mutex.lock();
+	}
+}
+
+void Select::unlockAll()
+{
+	for(auto it = m_locked.rbegin(); it != m_locked.rend(); ++it)
+	{
+		(*it)->m_mutex.unlock();
+	}
+}
+
+int Select::tryLocked(FiberWaitQueue& woken)
+{
+	for(size_t i=0;i<m_cases.size();i++)
+	{
+		Case& c = m_cases[i];
+		ChannelWaiter* waiter = nullptr;
+		ChannelBase::Result result = c.send ? c.channel->trySendLocked(c.value, waiter) : c.channel->tryRecvLocked(c.value, waiter);
+		if(result == ChannelBase::BLOCKED)
+		{
+			continue;
+		}
+		if(waiter)
+		{
+			woken.push(waiter);
+		}
+		m_closed = result == ChannelBase::CLOSED;
+		return i;
+	}
+	return -1;
+}
+
+int Select::tryWait()
+{
+	FiberWaitQueue woken;
+	lockAll();
+	int index = tryLocked(woken);
+	unlockAll();
+	FiberWaitQueue::WakeAll(woken.popAll());
+	return index;
+}
+
+int Select::wait()
+{
+	assert(!m_cases.empty());
+
+	// 1 锁住所有通道 有能完成的分支就直接完成
+	FiberWaitQueue woken;
+	lockAll();
+	int index = tryLocked(woken);
+	if(index != -1)
+	{
+		unlockAll();
+		FiberWaitQueue::WakeAll(woken.popAll());
+		return index;
+	}
+
+	// 2 在每个通道上挂一个等待者 -> 解锁后对方随时可能选中其中一个
+	bool in_fiber = Fiber::IsTaskFiber();
+	std::shared_ptr<Fiber> fiber = in_fiber ? Fiber::GetThis() : nullptr;
+	Scheduler* scheduler = in_fiber ? Scheduler::GetThis() : nullptr;
+	Semaphore sem;
+	*m_selected = -1;
+	for(size_t i=0;i<m_cases.size();i++)
+	{
+		Case& c = m_cases[i];
+		c.waiter.fiber = fiber;
+		c.waiter.scheduler = scheduler;
+		c.waiter.sem = in_fiber ? nullptr : &sem;
+		c.waiter.value = c.channel->waitValue(c.value);
+		c.waiter.selected = m_selected.get();
+		c.waiter.index = i;
+		c.waiter.result = 0;
+		(c.send ? c.channel->m_sendq : c.channel->m_recvq).push(&c.waiter);
+	}
+	fiber.reset();
+	unlockAll();
+
+	if(in_fiber)
+	{
+		Fiber::GetThis()->yield();
+	}
+	else
+	{
+		sem.wait();
+	}
+
+	// 3 摘掉其余分支的等待者 -> 之后不会再有通道访问它们
+	lockAll();
+	for(auto& c : m_cases)
+	{
+		(c.send ? c.channel->m_sendq : c.channel->m_recvq).remove(&c.waiter);
+		c.waiter.fiber.reset();
+	}
+	unlockAll();
+
+	for(auto& c : m_cases)
+	{
+		if(c.waiter.value != c.value)
+		{
+			c.channel->unboxValue(c.waiter.value, c.value);
+		}
+	}
+
+	index = *m_selected;
+	m_closed = m_cases[index].waiter.result == 0;
+	return index;
+}
+
+}
@@ -0,0 +1,272 @@
+#ifndef _CHANNEL_H_
+#define _CHANNEL_H_
+
+#include "fiber_sync.h"
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace sylar {
+
+// 协程间的有界多生产者多消费者通道
+// 缓冲区满时发送方挂起 空时接收方挂起 -> 有对方挂起时直接把值交给对方 不经过缓冲区
+// 值只移动不拷贝
+// 共享栈协程挂起期间栈内容会被换走 -> 等待者节点和要交换的值放在堆上 对方只读写堆上的副本
+
+// 挂在通道上的等待者 -> 发送时value指向要发送的值 接收时指向接收的位置
+struct ChannelWaiter : public FiberWaiter
+{
+	void* value = nullptr;
+	// 属于一次Select -> 每个分支在各自的通道上挂一个 第一个被选中的生效
+	std::atomic<int>* selected = nullptr;
+	int index = -1;
+};
+
+// 与元素类型无关的部分 -> 等待队列 关闭 Select
+class ChannelBase
+{
+public:
+	ChannelBase() = default;
+	ChannelBase(const ChannelBase&) = delete;
+	ChannelBase& operator=(const ChannelBase&) = delete;
+	virtual ~ChannelBase() = default;
+
+	// 关闭 -> 之后send()失败 recv()取完缓冲区后失败 挂起的发送方和接收方全部唤醒
+	void close();
+	bool isClosed();
+
+protected:
+	enum Result
+	{
+		// 已完成
+		DONE,
+		// 需要等待
+		BLOCKED,
+		// 通道已关闭
+		CLOSED
+	};
+
+	// 在m_mutex保护下尝试一次 -> 需要唤醒的对方通过woken返回
+	virtual Result trySendLocked(void* value, ChannelWaiter*& woken) = 0;
+	virtual Result tryRecvLocked(void* value, ChannelWaiter*& woken) = 0;
+
+	// 把共享栈上的值移到堆上 -> 挂起期间交给对方的是堆上的副本
+	virtual void* boxValue(void* value) = 0;
+	// 醒来后移回原处并释放
+	virtual void unboxValue(void* box, void* value) = 0;
+	// 挂起期间对方要访问value -> 在共享栈上时换成堆上的副本
+	void* waitValue(void* value) {return Fiber::IsOnSharedStack(value) ? boxValue(value) : value;}
+
+	// 取出一个等待者 -> 所属Select已经选中其他分支的直接丢弃
+	static ChannelWaiter* PopWaiter(FiberWaitQueue& queue);
+
+	bool send(void* value);
+	bool trySend(void* value);
+	bool recv(void* value);
+	bool tryRecv(void* value);
+
+	std::mutex m_mutex;
+	FiberWaitQueue m_sendq;
+	FiberWaitQueue m_recvq;
+	bool m_closed = false;
+
+	friend class Select;
+};
+
+template <class T>
+class Channel : public ChannelBase
+{
+public:
+	// capacity为0 -> 无缓冲 发送方等到接收方取走才返回
+	explicit Channel(size_t capacity = 0)
+		:m_capacity(capacity)
+	{
+		if(capacity > 0)
+		{
+			m_buffer.reset(new std::optional<T>[capacity]);
+		}
+	}
+
+	// 缓冲区满时挂起 通道关闭返回false
+	bool send(T value) {return ChannelBase::send(&value);}
+	// 满了或已关闭返回false -> 此时value不变
+	bool trySend(T&& value) {return ChannelBase::trySend(&value);}
+	// 发送values[0, n) -> 同一次加锁内交给所有挂起的接收方并一起唤醒 返回发送的个数 只在通道关闭时少于n
+	size_t send(T* values, size_t n);
+
+	// 缓冲区空时挂起 通道已关闭且取完返回false
+	bool recv(T& value) {return ChannelBase::recv(&value);}
+	// 空了或已关闭返回false
+	bool tryRecv(T& value) {return ChannelBase::tryRecv(&value);}
+
+	size_t capacity() const {return m_capacity;}
+	size_t size()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_size;
+	}
+
+protected:
+	Result trySendLocked(void* value, ChannelWaiter*& woken) override
+	{
+		T& v = *static_cast<T*>(value);
+		if(m_closed)
+		{
+			return CLOSED;
+		}
+		// 有接收方挂起 -> 缓冲区一定为空 直接交给它
+		ChannelWaiter* waiter = PopWaiter(m_recvq);
+		if(waiter)
+		{
+			*static_cast<T*>(waiter->value) = std::move(v);
+			waiter->result = 1;
+			woken = waiter;
+			return DONE;
+		}
+		if(m_size < m_capacity)
+		{
+			m_buffer[(m_head + m_size) % m_capacity].emplace(std::move(v));
+			++m_size;
+			return DONE;
+		}
+		return BLOCKED;
+	}
+
+	Result tryRecvLocked(void* value, ChannelWaiter*& woken) override
+	{
+		T& v = *static_cast<T*>(value);
+		if(m_size > 0)
+		{
+			std::optional<T>& head = m_buffer[m_head];
+			v = std::move(*head);
+			head.reset();
+			m_head = (m_head + 1) % m_capacity;
+			--m_size;
+			// 有发送方挂起 -> 把它的值补进空出来的位置
+			ChannelWaiter* waiter = PopWaiter(m_sendq);
+			if(waiter)
+			{
+				m_buffer[(m_head + m_size) % m_capacity].emplace(std::move(*static_cast<T*>(waiter->value)));
+				++m_size;
+				waiter->result = 1;
+				woken = waiter;
+			}
+			return DONE;
+		}
+		// 无缓冲 -> 直接从挂起的发送方取
+		ChannelWaiter* waiter = PopWaiter(m_sendq);
+		if(waiter)
+		{
+			v = std::move(*static_cast<T*>(waiter->value));
+			waiter->result = 1;
+			woken = waiter;
+			return DONE;
+		}
+		return m_closed ? CLOSED : BLOCKED;
+	}
+
+	void* boxValue(void* value) override
+	{
+		return new T(std::move(*static_cast<T*>(value)));
+	}
+
+	void unboxValue(void* box, void* value) override
+	{
+		T* boxed = static_cast<T*>(box);
+		*static_cast<T*>(value) = std::move(*boxed);
+		delete boxed;
+	}
+
+private:
+	size_t m_capacity;
+	// 环形缓冲区
+	std::unique_ptr<std::optional<T>[]> m_buffer;
+	size_t m_head = 0;
+	size_t m_size = 0;
+};
+
+template <class T>
+size_t Channel<T>::send(T* values, size_t n)
+{
+	size_t sent = 0;
+	while(sent < n)
+	{
+		FiberWaitQueue woken;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			while(sent < n)
+			{
+				ChannelWaiter* waiter = nullptr;
+				if(trySendLocked(&values[sent], waiter) != DONE)
+				{
+					break;
+				}
+				++sent;
+				if(waiter)
+				{
+					woken.push(waiter);
+				}
+			}
+		}
+		FiberWaitQueue::WakeAll(woken.popAll());
+
+		// 满了 -> 挂起等待下一个发送完成
+		if(sent == n || !ChannelBase::send(&values[sent]))
+		{
+			break;
+		}
+		++sent;
+	}
+	return sent;
+}
+
+// 同时等待多个通道上的收发 -> 第一个能完成的分支生效
+// 按通道地址顺序锁住所有通道后依次尝试 都不能完成时在每个通道上挂一个等待者
+//	Select select;
+//	select.recv(requests, request).recv(quit, signal);
+//	int index = select.wait();
+class Select
+{
+public:
+	// value在该分支被选中时才被读取或写入
+	template <class T>
+	Select& send(Channel<T>& channel, T& value) {return add(&channel, &value, true);}
+	template <class T>
+	Select& recv(Channel<T>& channel, T& value) {return add(&channel, &value, false);}
+
+	// 挂起直到某个分支完成 -> 返回其编号(添加顺序) 通道关闭也算完成 通过closed()区分
+	int wait();
+	// 没有能立即完成的分支返回-1
+	int tryWait();
+	// 选中的分支是因为通道关闭而完成的
+	bool closed() const {return m_closed;}
+
+private:
+	struct Case
+	{
+		ChannelBase* channel;
+		void* value;
+		bool send;
+		ChannelWaiter waiter;
+	};
+
+	Select& add(ChannelBase* channel, void* value, bool send);
+	// 锁住/解锁所有分支涉及的通道 -> 按地址排序去重 避免与其他Select死锁
+	void lockAll();
+	void unlockAll();
+	// 在所有通道已锁住时依次尝试 -> 返回完成的分支 需要唤醒的对方放入woken
+	int tryLocked(FiberWaitQueue& woken);
+
+	std::vector<Case> m_cases;
+	std::vector<ChannelBase*> m_locked;
+	// 等待者挂在通道上时对方会写它 -> 不放在可能位于共享栈上的Select里
+	std::unique_ptr<std::atomic<int>> m_selected = std::make_unique<std::atomic<int>>(-1);
+	bool m_closed = false;
+};
+
+}
+
+#endif
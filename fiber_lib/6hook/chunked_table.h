@@ -0,0 +1,101 @@
+#ifndef __SYLAR_CHUNKED_TABLE_H__
+#define __SYLAR_CHUNKED_TABLE_H__
+
+#include <atomic>
+#include <functional>
+#include <cstddef>
+
+namespace sylar {
+
+// two-level table indexed by fd -> a fixed array of chunk pointers, each chunk holds CHUNK_SIZE elements
+// elements never move once created, so pointers to them stay valid until the table is destroyed
+// lookups are wait-free, growth allocates one chunk and publishes it with a CAS -> readers never block
+template <class T, size_t CHUNK_SHIFT = 8, size_t MAX_CHUNKS = 16384>
+class ChunkedTable
+{
+public:
+    static const size_t CHUNK_SIZE = (size_t)1 << CHUNK_SHIFT;
+
+    // called for every element of a new chunk before the chunk is published
+    typedef std::function<void(T&, size_t)> Init;
+
+    explicit ChunkedTable(Init init = nullptr): m_init(std::move(init))
+    {
+        for (size_t i = 0; i < MAX_CHUNKS; ++i)
+        {
+            m_chunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~ChunkedTable()
+    {
+        for (size_t i = 0; i < MAX_CHUNKS; ++i)
+        {
+            delete m_chunks[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    ChunkedTable(const ChunkedTable&) = delete;
+    ChunkedTable& operator=(const ChunkedTable&) = delete;
+
+    size_t capacity() const { return MAX_CHUNKS << CHUNK_SHIFT; }
+
+    // nullptr -> the chunk holding index hasn't been created
+    T* get(size_t index) const
+    {
+        size_t chunk_index = index >> CHUNK_SHIFT;
+        if (chunk_index >= MAX_CHUNKS)
+        {
+            return nullptr;
+        }
+        Chunk* chunk = m_chunks[chunk_index].load(std::memory_order_acquire);
+        return chunk ? &chunk->items[index & (CHUNK_SIZE - 1)] : nullptr;
+    }
+
+    // create the chunk holding index if needed -> nullptr only when index is out of range
+    T* getOrCreate(size_t index)
+    {
+        size_t chunk_index = index >> CHUNK_SHIFT;
+        if (chunk_index >= MAX_CHUNKS)
+        {
+            return nullptr;
+        }
+
+        Chunk* chunk = m_chunks[chunk_index].load(std::memory_order_acquire);
+        if (!chunk)
+        {
+            Chunk* fresh = new Chunk;
+            if (m_init)
+            {
+                for (size_t i = 0; i < CHUNK_SIZE; ++i)
+                {
+                    m_init(fresh->items[i], (chunk_index << CHUNK_SHIFT) + i);
+                }
+            }
+            // lost the race -> use the winner's chunk
+            if (m_chunks[chunk_index].compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                chunk = fresh;
+            }
+            else
+            {
+                delete fresh;
+            }
+        }
+        return &chunk->items[index & (CHUNK_SIZE - 1)];
+    }
+
+private:
+    struct Chunk
+    {
+        T items[CHUNK_SIZE];
+    };
+
+private:
+    Init m_init;
+    std::atomic<Chunk*> m_chunks[MAX_CHUNKS];
+};
+
+} // end namespace sylar
+
+#endif
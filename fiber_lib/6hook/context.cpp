@@ -0,0 +1,198 @@
+#include "context.h"
+
+#include <cstdint>
+
+extern "C" {
+	// 保存callee-saved寄存器到当前栈 -> *from_sp = sp -> sp = to_sp -> 恢复寄存器并返回
+	void sylar_context_swap(void** from_sp, void* to_sp);
+	// 新上下文第一次被切入时的入口 -> 从保存的寄存器中取出fn和arg
+	void sylar_context_entry();
+}
+
+#if defined(__x86_64__)
+
+// 栈布局(低地址 -> 高地址): mxcsr/x87cw | r12 r13 r14 r15 rbx rbp | 返回地址
+__asm__(
+	".text\n"
+	".globl sylar_context_swap\n"
+	".hidden sylar_context_swap\n"
+	".type sylar_context_swap,@function\n"
+	".align 16\n"
+	"sylar_context_swap:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r15\n"
+	"	pushq %r14\n"
+	"	pushq %r13\n"
+	"	pushq %r12\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r12\n"
+	"	popq %r13\n"
+	"	popq %r14\n"
+	"	popq %r15\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	".size sylar_context_swap,.-sylar_context_swap\n"
+
+	".globl sylar_context_entry\n"
+	".hidden sylar_context_entry\n"
+	".type sylar_context_entry,@function\n"
+	".align 16\n"
+	"sylar_context_entry:\n"
+	"	movq %r13, %rdi\n"
+	"	callq *%r12\n"
+	"	ud2\n"
+	".size sylar_context_entry,.-sylar_context_entry\n"
+);
+
+#elif defined(__aarch64__)
+
+// 栈布局(低地址 -> 高地址): d8-d15 | x19-x28 | x29 x30
+__asm__(
+	".text\n"
+	".globl sylar_context_swap\n"
+	".hidden sylar_context_swap\n"
+	".type sylar_context_swap,%function\n"
+	".align 4\n"
+	"sylar_context_swap:\n"
+	"	sub sp, sp, #160\n"
+	"	stp d8, d9, [sp, #0]\n"
+	"	stp d10, d11, [sp, #16]\n"
+	"	stp d12, d13, [sp, #32]\n"
+	"	stp d14, d15, [sp, #48]\n"
+	"	stp x19, x20, [sp, #64]\n"
+	"	stp x21, x22, [sp, #80]\n"
+	"	stp x23, x24, [sp, #96]\n"
+	"	stp x25, x26, [sp, #112]\n"
+	"	stp x27, x28, [sp, #128]\n"
+	"	stp x29, x30, [sp, #144]\n"
+	"	mov x9, sp\n"
+	"	str x9, [x0]\n"
+	"	mov sp, x1\n"
+	"	ldp d8, d9, [sp, #0]\n"
+	"	ldp d10, d11, [sp, #16]\n"
+	"	ldp d12, d13, [sp, #32]\n"
+	"	ldp d14, d15, [sp, #48]\n"
+	"	ldp x19, x20, [sp, #64]\n"
+	"	ldp x21, x22, [sp, #80]\n"
+	"	ldp x23, x24, [sp, #96]\n"
+	"	ldp x25, x26, [sp, #112]\n"
+	"	ldp x27, x28, [sp, #128]\n"
+	"	ldp x29, x30, [sp, #144]\n"
+	"	add sp, sp, #160\n"
+	"	ret\n"
+	".size sylar_context_swap,.-sylar_context_swap\n"
+
+	".globl sylar_context_entry\n"
+	".hidden sylar_context_entry\n"
+	".type sylar_context_entry,%function\n"
+	".align 4\n"
+	"sylar_context_entry:\n"
+	"	mov x0, x20\n"
+	"	blr x19\n"
+	"	brk #0\n"
+	".size sylar_context_entry,.-sylar_context_entry\n"
+);
+
+#endif
+
+namespace sylar {
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+bool AsmContext::make(void* stack, size_t size, ContextEntry fn, void* arg)
+{
+	// 栈顶16字节对齐
+	uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+
+#if defined(__x86_64__)
+	// ret之后rsp = top - 16 -> call之前16字节对齐
+	void** sp = (void**)(top - 16);
+	*--sp = (void*)&sylar_context_entry; // 返回地址
+	*--sp = nullptr;                      // rbp
+	*--sp = nullptr;                      // rbx
+	*--sp = nullptr;                      // r15
+	*--sp = nullptr;                      // r14
+	*--sp = arg;                          // r13
+	*--sp = (void*)fn;                    // r12
+	--sp;
+	((uint32_t*)sp)[0] = 0x1F80;          // mxcsr默认值
+	((uint16_t*)sp)[2] = 0x037F;          // x87控制字默认值
+#else
+	void** sp = (void**)(top - 160);
+	for(int i=0;i<20;i++)
+	{
+		sp[i] = nullptr;
+	}
+	sp[8]  = (void*)fn;                   // x19
+	sp[9]  = arg;                         // x20
+	sp[19] = (void*)&sylar_context_entry; // x30
+#endif
+
+	m_sp = sp;
+	return true;
+}
+
+bool AsmContext::Swap(AsmContext* from, AsmContext* to)
+{
+	sylar_context_swap(&from->m_sp, to->m_sp);
+	return true;
+}
+
+#endif
+
+bool UContext::init()
+{
+	return getcontext(&m_ctx) == 0;
+}
+
+bool UContext::make(void* stack, size_t size, ContextEntry fn, void* arg)
+{
+	if(getcontext(&m_ctx))
+	{
+		return false;
+	}
+
+	m_fn = fn;
+	m_arg = arg;
+
+	m_ctx.uc_link = nullptr;
+	m_ctx.uc_stack.ss_sp = stack;
+	m_ctx.uc_stack.ss_size = size;
+
+	uint64_t self = (uint64_t)(uintptr_t)this;
+	makecontext(&m_ctx, (void (*)())&UContext::Trampoline, 2, (unsigned int)(self >> 32), (unsigned int)self);
+	return true;
+}
+
+bool UContext::Swap(UContext* from, UContext* to)
+{
+	return swapcontext(&from->m_ctx, &to->m_ctx) == 0;
+}
+
+void* UContext::getStackPointer() const
+{
+#if defined(__x86_64__)
+	return (void*)m_ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+	return (void*)m_ctx.uc_mcontext.sp;
+#else
+	return nullptr;
+#endif
+}
+
+void UContext::Trampoline(unsigned int hi, unsigned int lo)
+{
+	UContext* ctx = (UContext*)(uintptr_t)(((uint64_t)hi << 32) | (uint64_t)lo);
+	ctx->m_fn(ctx->m_arg);
+}
+
+}
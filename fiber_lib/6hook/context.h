@@ -0,0 +1,60 @@
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include <cstddef>
+#include <ucontext.h>
+
+namespace sylar {
+
+// 上下文入口函数
+typedef void (*ContextEntry)(void* arg);
+
+// 基于汇编的上下文 -> 只保存callee-saved寄存器 不涉及信号掩码 -> 无系统调用
+// 支持 x86-64 和 AArch64
+class AsmContext
+{
+public:
+	// 主协程的上下文 -> 第一次切出时自动保存
+	bool init() {return true;}
+	// 在给定的栈上创建上下文 -> 首次切入时执行fn(arg)
+	bool make(void* stack, size_t size, ContextEntry fn, void* arg);
+	// 保存当前上下文到from 切换到to
+	static bool Swap(AsmContext* from, AsmContext* to);
+
+	// 切出时保存的栈顶指针
+	void* getStackPointer() const {return m_sp;}
+
+private:
+	void* m_sp = nullptr;
+};
+
+// 基于ucontext的上下文 -> 每次切换都会调用rt_sigprocmask
+class UContext
+{
+public:
+	bool init();
+	bool make(void* stack, size_t size, ContextEntry fn, void* arg);
+	static bool Swap(UContext* from, UContext* to);
+
+	void* getStackPointer() const;
+
+private:
+	// makecontext只能传递int参数 -> 拆分指针
+	static void Trampoline(unsigned int hi, unsigned int lo);
+
+private:
+	ucontext_t m_ctx;
+	ContextEntry m_fn = nullptr;
+	void* m_arg = nullptr;
+};
+
+// 编译时选择Fiber使用的上下文 -> 定义SYLAR_FIBER_UCONTEXT或在不支持的平台上回退到ucontext
+#if defined(SYLAR_FIBER_UCONTEXT) || !(defined(__x86_64__) || defined(__aarch64__))
+typedef UContext FiberContext;
+#else
+typedef AsmContext FiberContext;
+#endif
+
+}
+
+#endif
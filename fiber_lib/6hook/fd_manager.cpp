@@ -4,6 +4,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <thread>
 
 namespace sylar{
 
@@ -12,7 +13,7 @@ template class Singleton<FdManager>;
 
 // Static variables need to be defined outside the class
 template<typename T>
-T* Singleton<T>::instance = nullptr;
+std::atomic<T*> Singleton<T>::instance = {nullptr};
 
 template<typename T>
 std::mutex Singleton<T>::mutex;	
@@ -20,7 +21,10 @@ std::mutex Singleton<T>::mutex;
 FdCtx::FdCtx(int fd):
 m_fd(fd)
 {
-	init();
+	if(m_fd != -1)
+	{
+		init();
+	}
 }
 
 FdCtx::~FdCtx()
@@ -59,6 +63,11 @@ bool FdCtx::init()
 			fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
 		}
 		m_sysNonblock = true;
+
+		// a short transfer only means drained on stream sockets
+		int type = 0;
+		socklen_t len = sizeof(type);
+		m_isStream = getsockopt_f(m_fd, SOL_SOCKET, SO_TYPE, &type, &len) == 0 && type == SOCK_STREAM;
 	}
 	else
 	{
@@ -68,15 +77,36 @@ bool FdCtx::init()
 	return m_isInit;
 }
 
+void FdCtx::reset(int fd)
+{
+	m_isInit = false;
+	m_isSocket = false;
+	m_sysNonblock = false;
+	m_userNonblock = false;
+	m_isClosed = false;
+	m_isStream = false;
+	m_fd = fd;
+	m_drained.store(0, std::memory_order_relaxed);
+	m_recvTimeout = (uint64_t)-1;
+	m_sendTimeout = (uint64_t)-1;
+	init();
+}
+
+void FdCtx::close()
+{
+	m_isClosed.store(true, std::memory_order_release);
+	m_generation.fetch_add(1, std::memory_order_acq_rel);
+}
+
 void FdCtx::setTimeout(int type, uint64_t v)
 {
 	if(type==SO_RCVTIMEO)
 	{
-		m_recvTimeout = v;
+		m_recvTimeout.store(v, std::memory_order_relaxed);
 	}
 	else
 	{
-		m_sendTimeout = v;
+		m_sendTimeout.store(v, std::memory_order_relaxed);
 	}
 }
 
@@ -84,63 +114,67 @@ uint64_t FdCtx::getTimeout(int type)
 {
 	if(type==SO_RCVTIMEO)
 	{
-		return m_recvTimeout;
+		return m_recvTimeout.load(std::memory_order_relaxed);
 	}
 	else
 	{
-		return m_sendTimeout;
+		return m_sendTimeout.load(std::memory_order_relaxed);
 	}
 }
 
 FdManager::FdManager()
 {
-	m_datas.resize(64);
+
 }
 
-std::shared_ptr<FdCtx> FdManager::get(int fd, bool auto_create)
+FdCtx* FdManager::get(int fd, bool auto_create)
 {
-	if(fd==-1)
+	if(fd < 0)
 	{
 		return nullptr;
 	}
 
-	std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-	if(m_datas.size() <= fd)
+	Slot* slot = auto_create ? m_datas.getOrCreate(fd) : m_datas.get(fd);
+	if(!slot)
 	{
-		if(auto_create==false)
-		{
-			return nullptr;
-		}
+		return nullptr;
 	}
-	else
+
+	int state = slot->state.load(std::memory_order_acquire);
+	if(state == Slot::LIVE)
 	{
-		if(m_datas[fd]||!auto_create)
-		{
-			return m_datas[fd];
-		}
+		return &slot->ctx;
 	}
-
-	read_lock.unlock();
-	std::unique_lock<std::shared_mutex> write_lock(m_mutex);
-
-	if(m_datas.size() <= fd)
+	if(!auto_create)
 	{
-		m_datas.resize(fd*1.5);
+		return nullptr;
 	}
 
-	m_datas[fd] = std::make_shared<FdCtx>(fd);
-	return m_datas[fd];
-
+	// the first creator initializes the slot -> the others wait for it
+	while(state != Slot::LIVE)
+	{
+		if(state == Slot::EMPTY && slot->state.compare_exchange_strong(state, Slot::INITIALIZING, std::memory_order_acquire))
+		{
+			slot->ctx.reset(fd);
+			slot->state.store(Slot::LIVE, std::memory_order_release);
+			break;
+		}
+		std::this_thread::yield();
+		state = slot->state.load(std::memory_order_acquire);
+	}
+	return &slot->ctx;
 }
 
 void FdManager::del(int fd)
 {
-	std::unique_lock<std::shared_mutex> write_lock(m_mutex);
-	if(m_datas.size() <= fd)
+	Slot* slot = fd < 0 ? nullptr : m_datas.get(fd);
+	if(!slot || slot->state.load(std::memory_order_acquire) != Slot::LIVE)
 	{
 		return;
 	}
-	m_datas[fd].reset();
+	// holders of the FdCtx see it closed before the slot can be reset for a new fd
+	slot->ctx.close();
+	slot->state.store(Slot::EMPTY, std::memory_order_release);
 }
 
-}
\ No newline at end of file
+}
@@ -2,42 +2,73 @@
 #define _FD_MANAGER_H_
 
 #include <memory>
-#include <shared_mutex>
+#include <atomic>
 #include "thread.h"
+#include "chunked_table.h"
 
 
 namespace sylar{
 
 // fd info
-class FdCtx : public std::enable_shared_from_this<FdCtx>
+// the same FdCtx is reused for the next fd with this number -> a holder may still read it while reset() runs,
+// so every field is atomic and getGeneration() tells whether it still describes the fd the holder looked up
+class FdCtx
 {
 private:
-	bool m_isInit = false;
-	bool m_isSocket = false;
-	bool m_sysNonblock = false;
-	bool m_userNonblock = false;
-	bool m_isClosed = false;
-	int m_fd;
+	std::atomic<bool> m_isInit = {false};
+	std::atomic<bool> m_isSocket = {false};
+	std::atomic<bool> m_sysNonblock = {false};
+	std::atomic<bool> m_userNonblock = {false};
+	std::atomic<bool> m_isClosed = {false};
+	std::atomic<bool> m_isStream = {false};
+	// only touched by the thread initializing the slot
+	int m_fd = -1;
+
+	// directions (IOManager::READ / WRITE) known to be drained -> the next operation parks without trying
+	std::atomic<uint32_t> m_drained = {0};
 
 	// read event timeout
-	uint64_t m_recvTimeout = (uint64_t)-1;
+	std::atomic<uint64_t> m_recvTimeout = {(uint64_t)-1};
 	// write event timeout
-	uint64_t m_sendTimeout = (uint64_t)-1;
+	std::atomic<uint64_t> m_sendTimeout = {(uint64_t)-1};
+
+	// bumped by close() -> differs from the value read before a yield once the fd was closed (and maybe reused)
+	std::atomic<uint64_t> m_generation = {0};
 
 public:
-	FdCtx(int fd);
+	// fd == -1 -> an empty slot, see reset()
+	FdCtx(int fd = -1);
 	~FdCtx();
 
 	bool init();
-	bool isInit() const {return m_isInit;}
-	bool isSocket() const {return m_isSocket;}
-	bool isClosed() const {return m_isClosed;}
-
-	void setUserNonblock(bool v) {m_userNonblock = v;}
-	bool getUserNonblock() const {return m_userNonblock;}
-
-	void setSysNonblock(bool v) {m_sysNonblock = v;}
-	bool getSysNonblock() const {return m_sysNonblock;}
+	// forget everything about the previous fd using this slot and init() for fd
+	void reset(int fd);
+	// the fd is being closed -> mark closed and start a new generation
+	void close();
+	bool isInit() const {return m_isInit.load(std::memory_order_relaxed);}
+	bool isSocket() const {return m_isSocket.load(std::memory_order_relaxed);}
+	bool isClosed() const {return m_isClosed.load(std::memory_order_acquire);}
+	bool isStream() const {return m_isStream.load(std::memory_order_relaxed);}
+	uint64_t getGeneration() const {return m_generation.load(std::memory_order_acquire);}
+
+	bool isDrained(uint32_t event) const {return m_drained.load(std::memory_order_relaxed) & event;}
+	void setDrained(uint32_t event, bool v)
+	{
+		if(v)
+		{
+			m_drained.fetch_or(event, std::memory_order_relaxed);
+		}
+		else
+		{
+			m_drained.fetch_and(~event, std::memory_order_relaxed);
+		}
+	}
+
+	void setUserNonblock(bool v) {m_userNonblock.store(v, std::memory_order_relaxed);}
+	bool getUserNonblock() const {return m_userNonblock.load(std::memory_order_relaxed);}
+
+	void setSysNonblock(bool v) {m_sysNonblock.store(v, std::memory_order_relaxed);}
+	bool getSysNonblock() const {return m_sysNonblock.load(std::memory_order_relaxed);}
 
 	void setTimeout(int type, uint64_t v);
 	uint64_t getTimeout(int type);
@@ -48,12 +79,30 @@ class FdManager
 public:
 	FdManager();
 
-	std::shared_ptr<FdCtx> get(int fd, bool auto_create = false);
+	// the FdCtx stays valid after del() -> callers hold a plain pointer
+	// and compare FdCtx::getGeneration() after a yield, the next fd with this number reuses it
+	FdCtx* get(int fd, bool auto_create = false);
+	// marks the FdCtx closed before releasing its slot
 	void del(int fd);
 
 private:
-	std::shared_mutex m_mutex;
-	std::vector<std::shared_ptr<FdCtx>> m_datas;
+	// FdCtx never moves or gets freed, close() only marks its slot empty
+	// -> a lookup is two loads, no lock, no refcount and nothing to reclaim
+	// -> reuse is detected by the FdCtx generation instead of retiring the old one
+	struct Slot
+	{
+		enum State
+		{
+			EMPTY,
+			// reset() in progress by the thread that created it
+			INITIALIZING,
+			LIVE
+		};
+		std::atomic<int> state = {EMPTY};
+		FdCtx ctx;
+	};
+
+	ChunkedTable<Slot> m_datas;
 };
 
 
@@ -61,7 +110,7 @@ template<typename T>
 class Singleton
 {
 private:
-    static T* instance;
+    static std::atomic<T*> instance;
     static std::mutex mutex;
 
 protected:
@@ -74,19 +123,25 @@ public:
 
     static T* GetInstance() 
     {
-        std::lock_guard<std::mutex> lock(mutex); // Ensure thread safety
-        if (instance == nullptr) 
+        // created already -> no lock
+        T* p = instance.load(std::memory_order_acquire);
+        if (p == nullptr) 
         {
-            instance = new T();
+            std::lock_guard<std::mutex> lock(mutex); // Ensure thread safety
+            p = instance.load(std::memory_order_relaxed);
+            if (p == nullptr) 
+            {
+                p = new T();
+                instance.store(p, std::memory_order_release);
+            }
         }
-        return instance;
+        return p;
     }
 
     static void DestroyInstance() 
     {
         std::lock_guard<std::mutex> lock(mutex);
-        delete instance;
-        instance = nullptr;
+        delete instance.exchange(nullptr);
     }
 };
 
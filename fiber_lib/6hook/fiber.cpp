@@ -1,4 +1,8 @@
 #include "fiber.h"
+#include "thread.h"
+
+#include <cstring>
+#include <cxxabi.h>
 
 static bool debug = false;
 
@@ -13,6 +17,57 @@ static thread_local std::shared_ptr<Fiber> t_thread_fiber = nullptr;
 // 调度协程
 static thread_local Fiber* t_scheduler_fiber = nullptr;
 
+// 线程共享栈
+struct Fiber::SharedStack
+{
+	// 共享栈大小 -> mmap按需分配 只有访问过的页驻留
+	static const size_t SIZE = 1024 * 1024;
+
+	char* stack = nullptr;
+	// 当前栈上保存着哪个协程的内容
+	Fiber* occupant = nullptr;
+	// 绑定的协程数
+	size_t bound = 0;
+	// 线程已退出 -> 最后一个绑定的协程析构时释放
+	bool orphan = false;
+
+	SharedStack()
+	{
+		stack = (char*)StackAllocator::Alloc(SIZE, StackAllocator::MMAP_STACK);
+		assert(stack != nullptr);
+	}
+
+	~SharedStack()
+	{
+		StackAllocator::Dealloc(stack, SIZE, StackAllocator::MMAP_STACK);
+	}
+
+	char* top() const {return stack + SIZE;}
+};
+
+struct SharedStackHolder
+{
+	Fiber::SharedStack* shared_stack = nullptr;
+
+	~SharedStackHolder()
+	{
+		if(shared_stack == nullptr)
+		{
+			return;
+		}
+		if(shared_stack->bound == 0)
+		{
+			delete shared_stack;
+		}
+		else
+		{
+			shared_stack->orphan = true;
+		}
+	}
+};
+
+static thread_local SharedStackHolder t_shared_stack;
+
 // 协程计数器
 static std::atomic<uint64_t> s_fiber_id{0};
 // 协程id
@@ -53,12 +108,79 @@ uint64_t Fiber::GetFiberId()
 	return (uint64_t)-1;
 }
 
+bool Fiber::IsTaskFiber()
+{
+	return t_fiber && t_fiber != t_thread_fiber.get() && t_fiber != t_scheduler_fiber && t_fiber->m_runInScheduler;
+}
+
+bool Fiber::IsCancelled()
+{
+	return t_fiber && t_fiber->m_cancelled;
+}
+
+bool Fiber::IsOnSharedStack()
+{
+	return t_fiber && t_fiber->m_sharedStack;
+}
+
+bool Fiber::IsOnSharedStack(const void* p)
+{
+	if(!IsOnSharedStack() || t_fiber->m_boundStack == nullptr)
+	{
+		return false;
+	}
+	const char* addr = static_cast<const char*>(p);
+	return addr >= t_fiber->m_boundStack->stack && addr < t_fiber->m_boundStack->top();
+}
+
+Fiber::Deadline Fiber::GetDeadline()
+{
+	return t_fiber ? t_fiber->m_deadline : Deadline::max();
+}
+
+void Fiber::cancel()
+{
+	std::lock_guard<std::mutex> lock(m_cancelMutex);
+	m_cancelled = true;
+	// 只唤醒一次 -> 唤醒后的协程会清除回调
+	if(m_cancelHook)
+	{
+		auto hook = m_cancelHook;
+		m_cancelHook = nullptr;
+		hook(m_cancelStorage);
+	}
+}
+
+bool Fiber::setCancelHook(void (*hook)(void*), const void* fn, size_t size)
+{
+	std::lock_guard<std::mutex> lock(m_cancelMutex);
+	if(m_cancelled)
+	{
+		return false;
+	}
+	memcpy(m_cancelStorage, fn, size);
+	m_cancelHook = hook;
+	return true;
+}
+
+void Fiber::clearCancelHook()
+{
+	std::lock_guard<std::mutex> lock(m_cancelMutex);
+	m_cancelHook = nullptr;
+}
+
+// 上下文入口 -> 转到MainFunc
+static void FiberEntry(void*)
+{
+	Fiber::MainFunc();
+}
+
 Fiber::Fiber()
 {
 	SetThis(this);
 	m_state = RUNNING;
 	
-	if(getcontext(&m_ctx))
+	if(!m_ctx.init())
 	{
 		std::cerr << "Fiber() failed\n";
 		pthread_exit(NULL);
@@ -69,26 +191,36 @@ Fiber::Fiber()
 	if(debug) std::cout << "Fiber(): main id = " << m_id << std::endl;
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler):
-m_cb(cb), m_runInScheduler(run_in_scheduler)
+Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler, bool shared_stack):
+m_cb(cb), m_runInScheduler(run_in_scheduler), m_sharedStack(shared_stack)
 {
 	m_state = READY;
 
+	// 共享栈 -> 首次resume时在所在线程的共享栈上创建上下文
+	if(m_sharedStack)
+	{
+		m_id = s_fiber_id++;
+		s_fiber_count ++;
+		if(debug) std::cout << "Fiber(): shared stack child id = " << m_id << std::endl;
+		return;
+	}
+
 	// 分配协程栈空间
-	m_stacksize = stacksize ? stacksize : 128000;
-	m_stack = malloc(m_stacksize);
+	m_stacksize = StackAllocator::RoundUp(stacksize ? stacksize : 128000);
+	m_stackType = StackAllocator::GetDefaultType();
+	m_stack = StackAllocator::Alloc(m_stacksize, m_stackType);
+	if(m_stack == nullptr)
+	{
+		std::cerr << "Fiber(): alloc stack failed\n";
+		pthread_exit(NULL);
+	}
 
-	if(getcontext(&m_ctx))
+	if(!m_ctx.make(m_stack, m_stacksize, &FiberEntry, nullptr))
 	{
 		std::cerr << "Fiber(std::function<void()> cb, size_t stacksize, bool run_in_scheduler) failed\n";
 		pthread_exit(NULL);
 	}
 	
-	m_ctx.uc_link = nullptr;
-	m_ctx.uc_stack.ss_sp = m_stack;
-	m_ctx.uc_stack.ss_size = m_stacksize;
-	makecontext(&m_ctx, &Fiber::MainFunc, 0);
-	
 	m_id = s_fiber_id++;
 	s_fiber_count ++;
 	if(debug) std::cout << "Fiber(): child id = " << m_id << std::endl;
@@ -99,40 +231,130 @@ Fiber::~Fiber()
 	s_fiber_count --;
 	if(m_stack)
 	{
-		free(m_stack);
+		StackAllocator::Dealloc(m_stack, m_stacksize, m_stackType);
+	}
+	if(m_boundStack)
+	{
+		if(m_boundStack->occupant == this)
+		{
+			m_boundStack->occupant = nullptr;
+		}
+		if(--m_boundStack->bound == 0 && m_boundStack->orphan)
+		{
+			delete m_boundStack;
+		}
 	}
+	free(m_saveBuffer);
 	if(debug) std::cout << "~Fiber(): id = " << m_id << std::endl;	
 }
 
+size_t Fiber::getStackResidentSize() const
+{
+	if(m_sharedStack)
+	{
+		return m_saveCapacity;
+	}
+	return StackAllocator::GetResidentSize(m_stack, m_stacksize);
+}
+
+void Fiber::saveStack()
+{
+	char* sp = (char*)m_ctx.getStackPointer();
+	size_t used = m_boundStack->top() - sp;
+
+	// 按实际使用量分配 -> 使用量大幅下降时收缩
+	if(m_saveCapacity < used || m_saveCapacity > used * 2)
+	{
+		free(m_saveBuffer);
+		m_saveBuffer = (char*)malloc(used);
+		m_saveCapacity = used;
+	}
+	memcpy(m_saveBuffer, sp, used);
+	m_saveSize = used;
+}
+
+void Fiber::restoreStack()
+{
+	if(m_saveSize)
+	{
+		memcpy(m_boundStack->top() - m_saveSize, m_saveBuffer, m_saveSize);
+	}
+}
+
 void Fiber::reset(std::function<void()> cb)
 {
-	assert(m_stack != nullptr&&m_state == TERM);
+	assert((m_stack != nullptr || m_sharedStack) && m_state == TERM);
 
 	m_state = READY;
 	m_cb = cb;
+	m_exception = nullptr;
+	m_cancelled = false;
+	m_deadline = Deadline::max();
 
-	if(getcontext(&m_ctx))
+	// 共享栈 -> 下次resume时重新创建上下文
+	if(m_sharedStack)
+	{
+		m_saveSize = 0;
+		return;
+	}
+
+	if(!m_ctx.make(m_stack, m_stacksize, &FiberEntry, nullptr))
 	{
 		std::cerr << "reset() failed\n";
 		pthread_exit(NULL);
 	}
-
-	m_ctx.uc_link = nullptr;
-	m_ctx.uc_stack.ss_sp = m_stack;
-	m_ctx.uc_stack.ss_size = m_stacksize;
-	makecontext(&m_ctx, &Fiber::MainFunc, 0);
 }
 
 void Fiber::resume()
 {
 	assert(m_state==READY);
+
+	if(m_sharedStack)
+	{
+		// 不能在共享栈协程中恢复另一个共享栈协程
+		assert(t_fiber == nullptr || !t_fiber->m_sharedStack);
+
+		if(t_shared_stack.shared_stack == nullptr)
+		{
+			t_shared_stack.shared_stack = new SharedStack();
+		}
+		SharedStack* shared_stack = t_shared_stack.shared_stack;
+
+		if(m_boundStack == nullptr)
+		{
+			m_boundStack = shared_stack;
+			m_boundStack->bound++;
+			m_boundThread = Thread::GetThreadId();
+		}
+		// 栈上的地址不能跨线程使用
+		assert(m_boundStack == shared_stack);
+
+		if(shared_stack->occupant != this)
+		{
+			// 把上一个协程的栈内容换出
+			if(shared_stack->occupant)
+			{
+				shared_stack->occupant->saveStack();
+			}
+			if(m_saveSize)
+			{
+				restoreStack();
+			}
+			else if(!m_ctx.make(shared_stack->stack, SharedStack::SIZE, &FiberEntry, nullptr))
+			{
+				std::cerr << "resume() make shared stack context failed\n";
+				pthread_exit(NULL);
+			}
+			shared_stack->occupant = this;
+		}
+	}
 	
 	m_state = RUNNING;
 
 	if(m_runInScheduler)
 	{
 		SetThis(this);
-		if(swapcontext(&(t_scheduler_fiber->m_ctx), &m_ctx))
+		if(!FiberContext::Swap(&(t_scheduler_fiber->m_ctx), &m_ctx))
 		{
 			std::cerr << "resume() to t_scheduler_fiber failed\n";
 			pthread_exit(NULL);
@@ -141,12 +363,18 @@ void Fiber::resume()
 	else
 	{
 		SetThis(this);
-		if(swapcontext(&(t_thread_fiber->m_ctx), &m_ctx))
+		if(!FiberContext::Swap(&(t_thread_fiber->m_ctx), &m_ctx))
 		{
 			std::cerr << "resume() to t_thread_fiber failed\n";
 			pthread_exit(NULL);
 		}	
 	}
+
+	// 已结束 -> 栈上的内容不再需要保存
+	if(m_sharedStack && m_state == TERM && m_boundStack->occupant == this)
+	{
+		m_boundStack->occupant = nullptr;
+	}
 }
 
 void Fiber::yield()
@@ -161,7 +389,7 @@ void Fiber::yield()
 	if(m_runInScheduler)
 	{
 		SetThis(t_scheduler_fiber);
-		if(swapcontext(&m_ctx, &(t_scheduler_fiber->m_ctx)))
+		if(!FiberContext::Swap(&m_ctx, &(t_scheduler_fiber->m_ctx)))
 		{
 			std::cerr << "yield() to to t_scheduler_fiber failed\n";
 			pthread_exit(NULL);
@@ -170,7 +398,7 @@ void Fiber::yield()
 	else
 	{
 		SetThis(t_thread_fiber.get());
-		if(swapcontext(&m_ctx, &(t_thread_fiber->m_ctx)))
+		if(!FiberContext::Swap(&m_ctx, &(t_thread_fiber->m_ctx)))
 		{
 			std::cerr << "yield() to t_thread_fiber failed\n";
 			pthread_exit(NULL);
@@ -183,7 +411,27 @@ void Fiber::MainFunc()
 	std::shared_ptr<Fiber> curr = GetThis();
 	assert(curr!=nullptr);
 
-	curr->m_cb(); 
+	// 异常不能穿过上下文入口向上传播 -> 在这里截住 保存在协程上 由getException()取出
+	// 需要把异常交给等待方的(如go())在协程函数内自己捕获
+	try
+	{
+		curr->m_cb(); 
+	}
+	catch(abi::__forced_unwind&)
+	{
+		// 线程取消/pthread_exit()的强制展开 -> 必须继续向上传播
+		throw;
+	}
+	catch(const std::exception& e)
+	{
+		if(debug) std::cerr << "Fiber " << curr->getId() << " terminated by exception: " << e.what() << std::endl;
+		curr->m_exception = std::current_exception();
+	}
+	catch(...)
+	{
+		if(debug) std::cerr << "Fiber " << curr->getId() << " terminated by unknown exception" << std::endl;
+		curr->m_exception = std::current_exception();
+	}
 	curr->m_cb = nullptr;
 	curr->m_state = TERM;
 
@@ -193,4 +441,24 @@ void Fiber::MainFunc()
 	raw_ptr->yield(); 
 }
 
-}
\ No newline at end of file
+DeadlineScope::DeadlineScope(std::chrono::steady_clock::duration timeout)
+	:DeadlineScope(std::chrono::steady_clock::now() + timeout)
+{
+}
+
+DeadlineScope::DeadlineScope(Fiber::Deadline deadline)
+	:m_fiber(Fiber::GetThis().get())
+{
+	m_saved = m_fiber->getDeadline();
+	if(deadline < m_saved)
+	{
+		m_fiber->setDeadline(deadline);
+	}
+}
+
+DeadlineScope::~DeadlineScope()
+{
+	m_fiber->setDeadline(m_saved);
+}
+
+}
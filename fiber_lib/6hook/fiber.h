@@ -5,16 +5,25 @@
 #include <memory>       
 #include <atomic>       
 #include <functional>   
+#include <exception>
 #include <cassert>      
-#include <ucontext.h>   
 #include <unistd.h>
 #include <mutex>
+#include <chrono>
+#include <optional>
+#include <type_traits>
+#include <cstddef>
+
+#include "context.h"
+#include "stack_allocator.h"
 
 namespace sylar {
 
 class Fiber : public std::enable_shared_from_this<Fiber>
 {
 public:
+	typedef std::chrono::steady_clock::time_point Deadline;
+
 	// 协程状态
 	enum State
 	{
@@ -28,7 +37,8 @@ private:
 	Fiber();
 
 public:
-	Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true);
+	// shared_stack -> 运行在线程共享栈上 切出时只保存实际使用的部分 -> 首次运行后只能在该线程上恢复
+	Fiber(std::function<void()> cb, size_t stacksize = 0, bool run_in_scheduler = true, bool shared_stack = false);
 	~Fiber();
 
 	// 重用一个协程
@@ -41,6 +51,39 @@ public:
 
 	uint64_t getId() const {return m_id;}
 	State getState() const {return m_state;}
+	// 协程函数抛出且未被捕获的异常 -> 结束(TERM)后有效 reset()时清除
+	std::exception_ptr getException() const {return m_exception;}
+
+	// 协程栈保留的大小
+	size_t getStackReservedSize() const {return m_sharedStack ? m_saveCapacity : m_stacksize;}
+	// 协程栈实际驻留内存的大小
+	size_t getStackResidentSize() const;
+
+	// 协作式取消 -> 标记取消 正挂起在hook的io/connect/sleep上时立即唤醒它 这些调用返回ECANCELED
+	// 之后再挂起等待也直接返回ECANCELED 可以在任意线程调用
+	void cancel();
+	bool isCancelled() const {return m_cancelled;}
+
+	// 挂起等待前登记取消回调 -> 已被取消时不登记并返回false 回调在cancel()的线程上执行
+	// fn复制到协程对象中 -> 挂起期间栈可能被换走(共享栈) 所以fn只能捕获值和不在栈上的地址
+	template <class F>
+	bool setCancelHook(const F& fn)
+	{
+		static_assert(std::is_trivially_copyable<F>::value && sizeof(F) <= CANCEL_HOOK_SIZE && alignof(F) <= alignof(std::max_align_t),
+			"cancel hook must be a small closure capturing values and pointers only");
+		return setCancelHook([](void* arg){(*static_cast<F*>(arg))();}, &fn, sizeof(F));
+	}
+	// 恢复后注销 -> 等待正在执行的回调结束 返回后回调不会再执行
+	void clearCancelHook();
+
+	// 截止时间 -> hook的io/connect/sleep最多挂起到这个时间点 之后返回ETIMEDOUT 默认Deadline::max()不限制
+	// 只在协程自身中修改 通常通过DeadlineScope
+	Deadline getDeadline() const {return m_deadline;}
+	void setDeadline(Deadline deadline) {m_deadline = deadline;}
+
+	bool isSharedStack() const {return m_sharedStack;}
+	// 共享栈协程所在的线程id -> 未运行过或独立栈协程返回-1
+	int getBoundThread() const {return m_boundThread;}
 
 public:
 	// 设置当前运行的协程
@@ -55,9 +98,33 @@ public:
 	// 得到当前运行的协程id
 	static uint64_t GetFiberId();
 
+	// 当前是否运行在调度器的任务协程中 -> 可以挂起等待重新调度 否则只能阻塞线程
+	static bool IsTaskFiber();
+
+	// 当前协程是否已被取消 -> 供协程函数主动检查
+	static bool IsCancelled();
+
+	// 当前是否运行在共享栈协程中 -> 挂起后栈上的地址会被同线程的其他共享栈协程复用
+	static bool IsOnSharedStack();
+	// p是否位于当前协程的共享栈上 -> 这样的地址不能在挂起期间交给别人读写
+	static bool IsOnSharedStack(const void* p);
+
+	// 当前协程的截止时间 -> 不在协程中返回Deadline::max()
+	static Deadline GetDeadline();
+
 	// 协程函数
 	static void MainFunc();	
 
+	// 线程共享栈
+	struct SharedStack;
+
+private:
+	// 共享栈 -> 保存/恢复栈上实际使用的部分
+	void saveStack();
+	void restoreStack();
+	// 把size字节的闭包fn复制到m_cancelStorage后登记hook
+	bool setCancelHook(void (*hook)(void*), const void* fn, size_t size);
+
 private:
 	// id
 	uint64_t m_id = 0;
@@ -66,18 +133,96 @@ private:
 	// 协程状态
 	State m_state = READY;
 	// 协程上下文
-	ucontext_t m_ctx;
+	FiberContext m_ctx;
 	// 协程栈指针
 	void* m_stack = nullptr;
+	// 协程栈类型
+	StackAllocator::Type m_stackType = StackAllocator::MALLOC_STACK;
 	// 协程函数
 	std::function<void()> m_cb;
+	// 协程函数抛出的异常
+	std::exception_ptr m_exception;
+
+	// 是否已被取消
+	std::atomic<bool> m_cancelled = {false};
+	// 挂起时登记的取消回调和它的闭包 -> m_cancelMutex保护 回调执行期间也持有
+	static const size_t CANCEL_HOOK_SIZE = 48;
+	std::mutex m_cancelMutex;
+	void (*m_cancelHook)(void*) = nullptr;
+	alignas(std::max_align_t) char m_cancelStorage[CANCEL_HOOK_SIZE];
+	// 截止时间
+	Deadline m_deadline = Deadline::max();
 	// 是否让出执行权交给调度协程
 	bool m_runInScheduler;
 
+	// 是否使用共享栈
+	bool m_sharedStack = false;
+	// 绑定的线程共享栈 -> 首次resume时绑定
+	SharedStack* m_boundStack = nullptr;
+	int m_boundThread = -1;
+	// 切出时保存的栈内容
+	char* m_saveBuffer = nullptr;
+	size_t m_saveSize = 0;
+	size_t m_saveCapacity = 0;
+
 public:
 	std::mutex m_mutex;
 };
 
+// 挂起期间会被其他线程/定时器/内核读写的对象 -> 不能放在共享栈协程的栈上
+// 当前协程在共享栈上时分配在堆上 否则就地构造 不分配内存
+//	OffStack<FiberWaiter> waiter;
+//	m_waiters.wait(*waiter, lock);
+template <class T>
+class OffStack
+{
+public:
+	template <class... Args>
+	explicit OffStack(Args&&... args)
+	{
+		if(Fiber::IsOnSharedStack())
+		{
+			m_heap.reset(new T(std::forward<Args>(args)...));
+			m_ptr = m_heap.get();
+		}
+		else
+		{
+			m_ptr = &m_local.emplace(std::forward<Args>(args)...);
+		}
+	}
+
+	OffStack(const OffStack&) = delete;
+	OffStack& operator=(const OffStack&) = delete;
+
+	T* get() const {return m_ptr;}
+	T* operator->() const {return m_ptr;}
+	T& operator*() const {return *m_ptr;}
+
+private:
+	std::optional<T> m_local;
+	std::unique_ptr<T> m_heap;
+	T* m_ptr;
+};
+
+// 在作用域内收紧当前协程的截止时间 -> 只能提前不能推后 析构时恢复 可以嵌套
+//	DeadlineScope scope(std::chrono::milliseconds(200));
+//	recv(fd, buf, len, 0);	// 200ms内没有数据 -> 返回-1 errno为ETIMEDOUT
+class DeadlineScope
+{
+public:
+	explicit DeadlineScope(std::chrono::steady_clock::duration timeout);
+	explicit DeadlineScope(Fiber::Deadline deadline);
+	~DeadlineScope();
+
+	DeadlineScope(const DeadlineScope&) = delete;
+	DeadlineScope& operator=(const DeadlineScope&) = delete;
+
+private:
+	Fiber* m_fiber;
+	// 进入作用域前的截止时间
+	Fiber::Deadline m_saved;
+};
+
 }
 
 #endif
@@ -0,0 +1,406 @@
+#include "fiber_sync.h"
+
+#include <cassert>
+
+namespace sylar {
+
+void FiberWaitQueue::push(FiberWaiter* waiter)
+{
+	waiter->next = nullptr;
+	if(m_tail)
+	{
+		m_tail->next = waiter;
+	}
+	else
+	{
+		m_head = waiter;
+	}
+	m_tail = waiter;
+}
+
+FiberWaiter* FiberWaitQueue::pop()
+{
+	FiberWaiter* waiter = m_head;
+	if(waiter)
+	{
+		m_head = waiter->next;
+		if(!m_head)
+		{
+			m_tail = nullptr;
+		}
+	}
+	return waiter;
+}
+
+FiberWaiter* FiberWaitQueue::popAll()
+{
+	FiberWaiter* waiters = m_head;
+	m_head = nullptr;
+	m_tail = nullptr;
+	return waiters;
+}
+
+bool FiberWaitQueue::remove(FiberWaiter* waiter)
+{
+	FiberWaiter* prev = nullptr;
+	for(FiberWaiter* cur = m_head; cur; prev = cur, cur = cur->next)
+	{
+		if(cur != waiter)
+		{
+			continue;
+		}
+		if(prev)
+		{
+			prev->next = cur->next;
+		}
+		else
+		{
+			m_head = cur->next;
+		}
+		if(m_tail == cur)
+		{
+			m_tail = prev;
+		}
+		return true;
+	}
+	return false;
+}
+
+void FiberWaitQueue::wait(FiberWaiter& waiter, std::unique_lock<std::mutex>& lock)
+{
+	// 唤醒方会在我们挂起时读写waiter -> 不能在共享栈上
+	assert(!Fiber::IsOnSharedStack(&waiter) && "FiberWaiter on a shared stack, allocate it with OffStack");
+	if(Fiber::IsTaskFiber())
+	{
+		waiter.fiber = Fiber::GetThis();
+		waiter.scheduler = Scheduler::GetThis();
+		push(&waiter);
+		lock.unlock();
+
+		// 唤醒方可能在yield()之前就重新调度了本协程 -> 调度器恢复前会等待Fiber::m_mutex 即等本次yield()完成
+		Fiber::GetThis()->yield();
+	}
+	else
+	{
+		Semaphore sem;
+		waiter.sem = &sem;
+		push(&waiter);
+		lock.unlock();
+		sem.wait();
+	}
+	lock.lock();
+}
+
+void FiberWaitQueue::Wake(FiberWaiter* waiter)
+{
+	// 重新调度后waiter所在的栈随时可能被释放 -> 先取出需要的内容
+	Scheduler* scheduler = waiter->scheduler;
+	Semaphore* sem = waiter->sem;
+	std::shared_ptr<Fiber> fiber = waiter->fiber;
+	if(sem)
+	{
+		sem->signal();
+	}
+	else
+	{
+		scheduler->scheduleLock(fiber);
+	}
+}
+
+void FiberWaitQueue::WakeAll(FiberWaiter* waiters)
+{
+	static const size_t BATCH = 32;
+	std::shared_ptr<Fiber> batch[BATCH];
+	size_t n = 0;
+	Scheduler* scheduler = nullptr;
+
+	while(waiters)
+	{
+		FiberWaiter* next = waiters->next;
+		// 换了调度器或攒满 -> 先提交已有的
+		if(n > 0 && (waiters->scheduler != scheduler || n == BATCH))
+		{
+			scheduler->scheduleBatch(batch, n);
+			n = 0;
+		}
+		if(waiters->sem)
+		{
+			Wake(waiters);
+		}
+		else
+		{
+			scheduler = waiters->scheduler;
+			batch[n++] = waiters->fiber;
+		}
+		waiters = next;
+	}
+	if(n > 0)
+	{
+		scheduler->scheduleBatch(batch, n);
+	}
+}
+
+void FiberMutex::lock()
+{
+	int state = UNLOCKED;
+	if(m_state.compare_exchange_strong(state, LOCKED, std::memory_order_acquire))
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	// 标记为有等待者再尝试 -> 拿到时保守地保留CONTENDED 解锁时多检查一次队列
+	while(m_state.exchange(CONTENDED, std::memory_order_acquire) != UNLOCKED)
+	{
+		OffStack<FiberWaiter> waiter;
+		m_waiters.wait(*waiter, lock);
+	}
+}
+
+bool FiberMutex::try_lock()
+{
+	int state = UNLOCKED;
+	return m_state.compare_exchange_strong(state, LOCKED, std::memory_order_acquire);
+}
+
+void FiberMutex::unlock()
+{
+	if(m_state.exchange(UNLOCKED, std::memory_order_release) != CONTENDED)
+	{
+		return;
+	}
+
+	// 唤醒一个 -> 它重新竞争 不直接交接 避免锁在它被调度前一直空闲
+	FiberWaiter* waiter = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		waiter = m_waiters.pop();
+	}
+	if(waiter)
+	{
+		FiberWaitQueue::Wake(waiter);
+	}
+}
+
+void FiberRWMutex::lock()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if(!m_writer && m_readers == 0)
+	{
+		m_writer = true;
+		return;
+	}
+
+	// 解锁方直接把写锁交给我们
+	++m_writersWaiting;
+	OffStack<FiberWaiter> waiter;
+	m_writeQueue.wait(*waiter, lock);
+}
+
+bool FiberRWMutex::try_lock()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_writer && m_readers == 0)
+	{
+		m_writer = true;
+		return true;
+	}
+	return false;
+}
+
+void FiberRWMutex::unlock()
+{
+	FiberWaiter* waiters = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		assert(m_writer);
+		m_writer = false;
+
+		// 先放行排队的读者 -> 读者不会被连续的写者饿死
+		if(!m_readQueue.empty())
+		{
+			waiters = m_readQueue.popAll();
+			for(FiberWaiter* waiter = waiters; waiter; waiter = waiter->next)
+			{
+				++m_readers;
+			}
+		}
+		else if(!m_writeQueue.empty())
+		{
+			waiters = m_writeQueue.pop();
+			waiters->next = nullptr;
+			--m_writersWaiting;
+			m_writer = true;
+		}
+	}
+	FiberWaitQueue::WakeAll(waiters);
+}
+
+void FiberRWMutex::lock_shared()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if(!m_writer && m_writersWaiting == 0)
+	{
+		++m_readers;
+		return;
+	}
+
+	// 解锁方已经替我们加了读锁
+	OffStack<FiberWaiter> waiter;
+	m_readQueue.wait(*waiter, lock);
+}
+
+bool FiberRWMutex::try_lock_shared()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(!m_writer && m_writersWaiting == 0)
+	{
+		++m_readers;
+		return true;
+	}
+	return false;
+}
+
+void FiberRWMutex::unlock_shared()
+{
+	FiberWaiter* waiter = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		assert(m_readers > 0);
+		if(--m_readers == 0 && !m_writeQueue.empty())
+		{
+			waiter = m_writeQueue.pop();
+			--m_writersWaiting;
+			m_writer = true;
+		}
+	}
+	if(waiter)
+	{
+		FiberWaitQueue::Wake(waiter);
+	}
+}
+
+void FiberCondVar::wait(std::unique_lock<FiberMutex>& lock)
+{
+	std::unique_lock<std::mutex> inner(m_mutex);
+	// 先入队再释放mutex -> 释放后的notify一定能看到我们
+	OffStack<FiberWaiter> waiter;
+	if(Fiber::IsTaskFiber())
+	{
+		waiter->fiber = Fiber::GetThis();
+		waiter->scheduler = Scheduler::GetThis();
+		m_waiters.push(waiter.get());
+		inner.unlock();
+		lock.unlock();
+		Fiber::GetThis()->yield();
+	}
+	else
+	{
+		Semaphore sem;
+		waiter->sem = &sem;
+		m_waiters.push(waiter.get());
+		inner.unlock();
+		lock.unlock();
+		sem.wait();
+	}
+	lock.lock();
+}
+
+void FiberCondVar::notify_one()
+{
+	FiberWaiter* waiter = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		waiter = m_waiters.pop();
+	}
+	if(waiter)
+	{
+		FiberWaitQueue::Wake(waiter);
+	}
+}
+
+void FiberCondVar::notify_all()
+{
+	FiberWaiter* waiters = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		waiters = m_waiters.popAll();
+	}
+	FiberWaitQueue::WakeAll(waiters);
+}
+
+void FiberSemaphore::wait()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if(m_count > 0)
+	{
+		--m_count;
+		return;
+	}
+
+	// signal()直接把许可交给我们
+	OffStack<FiberWaiter> waiter;
+	m_waiters.wait(*waiter, lock);
+}
+
+bool FiberSemaphore::tryWait()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_count > 0)
+	{
+		--m_count;
+		return true;
+	}
+	return false;
+}
+
+void FiberSemaphore::signal(size_t n)
+{
+	FiberWaitQueue woken;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		while(n > 0 && !m_waiters.empty())
+		{
+			woken.push(m_waiters.pop());
+			--n;
+		}
+		m_count += n;
+	}
+	FiberWaitQueue::WakeAll(woken.popAll());
+}
+
+void WaitGroup::add(int64_t n)
+{
+	int64_t count = m_count.fetch_add(n) + n;
+	assert(count >= 0);
+	if(count != 0)
+	{
+		return;
+	}
+
+	// 归零 -> 唤醒所有等待者
+	FiberWaiter* waiters = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		waiters = m_waiters.popAll();
+	}
+	FiberWaitQueue::WakeAll(waiters);
+}
+
+void WaitGroup::wait()
+{
+	if(m_count == 0)
+	{
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if(m_count == 0)
+	{
+		return;
+	}
+	OffStack<FiberWaiter> waiter;
+	m_waiters.wait(*waiter, lock);
+}
+
+}
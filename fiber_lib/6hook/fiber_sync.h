@@ -0,0 +1,175 @@
+#ifndef _FIBER_SYNC_H_
+#define _FIBER_SYNC_H_
+
+#include "scheduler.h"
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+
+namespace sylar {
+
+// 协程同步原语 -> 等待时挂起当前协程 由唤醒方通过Scheduler::scheduleLock()重新调度 不阻塞工作线程
+// 不在任务协程中(普通线程/主协程)调用时退化为阻塞线程
+// 等待者节点放在等待方的栈上 -> 挂起和唤醒都不分配内存
+// 共享栈协程挂起后栈内容会被换走 唤醒方却要读写节点 -> 节点放在堆上(OffStack)
+
+// 一个等待者
+struct FiberWaiter
+{
+	// 挂起的协程和它所在的调度器
+	std::shared_ptr<Fiber> fiber;
+	Scheduler* scheduler = nullptr;
+	// 不在协程中 -> 阻塞在线程信号量上
+	Semaphore* sem = nullptr;
+	FiberWaiter* next = nullptr;
+	// 唤醒方交给等待方的结果 -> 由具体的原语解释
+	int result = 0;
+};
+
+// 等待者的FIFO队列 -> 由原语自己的互斥锁保护
+class FiberWaitQueue
+{
+public:
+	bool empty() const {return m_head == nullptr;}
+
+	void push(FiberWaiter* waiter);
+	FiberWaiter* pop();
+	// 取出全部 -> 按入队顺序通过next链接
+	FiberWaiter* popAll();
+	// 从队列中间摘除 -> 已经被取出返回false
+	bool remove(FiberWaiter* waiter);
+
+	// 在lock保护下把waiter放入队列 释放lock后挂起 直到被Wake() -> waiter用OffStack<FiberWaiter>分配
+	void wait(FiberWaiter& waiter, std::unique_lock<std::mutex>& lock);
+	// 重新调度waiter -> 在释放原语的锁之后调用
+	static void Wake(FiberWaiter* waiter);
+	// 唤醒popAll()取出的全部等待者 -> 同一调度器的协程通过scheduleBatch()一次提交
+	static void WakeAll(FiberWaiter* waiters);
+
+private:
+	FiberWaiter* m_head = nullptr;
+	FiberWaiter* m_tail = nullptr;
+};
+
+// 互斥锁 -> 无竞争时只有一次CAS
+class FiberMutex
+{
+public:
+	FiberMutex() = default;
+	FiberMutex(const FiberMutex&) = delete;
+	FiberMutex& operator=(const FiberMutex&) = delete;
+
+	void lock();
+	bool try_lock();
+	void unlock();
+
+private:
+	enum State
+	{
+		UNLOCKED,
+		LOCKED,
+		// 加锁且可能有等待者 -> 解锁时需要唤醒
+		CONTENDED
+	};
+
+	std::atomic<int> m_state = {UNLOCKED};
+	// 保护等待队列
+	std::mutex m_mutex;
+	FiberWaitQueue m_waiters;
+};
+
+// 读写锁 -> 写者优先: 有写者等待时新的读者排队 写者解锁时先放行所有排队的读者
+class FiberRWMutex
+{
+public:
+	FiberRWMutex() = default;
+	FiberRWMutex(const FiberRWMutex&) = delete;
+	FiberRWMutex& operator=(const FiberRWMutex&) = delete;
+
+	void lock();
+	bool try_lock();
+	void unlock();
+
+	void lock_shared();
+	bool try_lock_shared();
+	void unlock_shared();
+
+private:
+	std::mutex m_mutex;
+	// 持有读锁的数量
+	size_t m_readers = 0;
+	bool m_writer = false;
+	FiberWaitQueue m_readQueue;
+	FiberWaitQueue m_writeQueue;
+	size_t m_writersWaiting = 0;
+};
+
+// 条件变量 -> 配合FiberMutex
+class FiberCondVar
+{
+public:
+	FiberCondVar() = default;
+	FiberCondVar(const FiberCondVar&) = delete;
+	FiberCondVar& operator=(const FiberCondVar&) = delete;
+
+	// 释放mutex并挂起 被唤醒后重新加锁
+	void wait(std::unique_lock<FiberMutex>& lock);
+
+	template <class Predicate>
+	void wait(std::unique_lock<FiberMutex>& lock, Predicate pred)
+	{
+		while(!pred())
+		{
+			wait(lock);
+		}
+	}
+
+	void notify_one();
+	void notify_all();
+
+private:
+	std::mutex m_mutex;
+	FiberWaitQueue m_waiters;
+};
+
+// 计数信号量 -> 释放时直接把许可交给排队最久的等待者
+class FiberSemaphore
+{
+public:
+	explicit FiberSemaphore(size_t count = 0): m_count(count) {}
+	FiberSemaphore(const FiberSemaphore&) = delete;
+	FiberSemaphore& operator=(const FiberSemaphore&) = delete;
+
+	void wait();
+	bool tryWait();
+	void signal(size_t n = 1);
+
+private:
+	std::mutex m_mutex;
+	size_t m_count;
+	FiberWaitQueue m_waiters;
+};
+
+// 等待一组任务完成 -> add()登记数量 每个任务结束时done() wait()等到计数归零
+class WaitGroup
+{
+public:
+	WaitGroup() = default;
+	WaitGroup(const WaitGroup&) = delete;
+	WaitGroup& operator=(const WaitGroup&) = delete;
+
+	void add(int64_t n = 1);
+	void done() {add(-1);}
+	void wait();
+
+private:
+	std::atomic<int64_t> m_count = {0};
+	std::mutex m_mutex;
+	FiberWaitQueue m_waiters;
+};
+
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include "future.h"
+
+namespace sylar {
+
+bool FutureStateBase::isReady()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_ready;
+}
+
+void FutureStateBase::wait()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if(m_ready)
+	{
+		return;
+	}
+	OffStack<FiberWaiter> waiter;
+	m_waiters.wait(*waiter, lock);
+}
+
+void FutureStateBase::onReady(std::function<void()> cb)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(!m_ready)
+		{
+			m_callbacks.push_back(std::move(cb));
+			return;
+		}
+	}
+	cb();
+}
+
+void FutureStateBase::setException(std::exception_ptr exception)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	assert(!m_ready);
+	m_exception = exception;
+	complete(lock);
+}
+
+void FutureStateBase::rethrow()
+{
+	// 完成后不再修改 -> 不需要加锁
+	if(m_exception)
+	{
+		std::rethrow_exception(m_exception);
+	}
+}
+
+void FutureStateBase::complete(std::unique_lock<std::mutex>& lock)
+{
+	m_ready = true;
+	FiberWaiter* waiters = m_waiters.popAll();
+	std::vector<std::function<void()>> callbacks;
+	callbacks.swap(m_callbacks);
+	lock.unlock();
+
+	FiberWaitQueue::WakeAll(waiters);
+	for(auto& cb : callbacks)
+	{
+		cb();
+	}
+}
+
+}
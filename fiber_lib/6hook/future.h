@@ -0,0 +1,219 @@
+#ifndef _FUTURE_H_
+#define _FUTURE_H_
+
+#include "fiber_sync.h"
+
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+namespace sylar {
+
+// 协程的Future/Promise -> get()挂起当前协程直到结果就绪 不阻塞工作线程
+// 不在任务协程中调用时退化为阻塞线程
+//	auto a = go([]{return fetch("a");});
+//	auto b = go([]{return fetch("b");});
+//	std::string r = a.get() + b.get();
+
+// 与结果类型无关的部分 -> 完成标记 异常 等待者 完成回调
+class FutureStateBase
+{
+public:
+	bool isReady();
+	// 挂起直到完成
+	void wait();
+	// 完成时回调 -> 在完成方的线程上执行 已完成则立即在当前线程执行
+	void onReady(std::function<void()> cb);
+
+	void setException(std::exception_ptr exception);
+	// 完成后调用 -> 有异常则重新抛出
+	void rethrow();
+
+protected:
+	// 在m_mutex保护下写入结果后调用 -> 标记完成 解锁后唤醒等待者并执行回调
+	void complete(std::unique_lock<std::mutex>& lock);
+
+	std::mutex m_mutex;
+	bool m_ready = false;
+	std::exception_ptr m_exception;
+	FiberWaitQueue m_waiters;
+	std::vector<std::function<void()>> m_callbacks;
+};
+
+template <class T>
+class FutureState : public FutureStateBase
+{
+public:
+	void setValue(T value)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		assert(!m_ready);
+		m_value.emplace(std::move(value));
+		complete(lock);
+	}
+
+	T take() {return std::move(*m_value);}
+
+private:
+	std::optional<T> m_value;
+};
+
+template <>
+class FutureState<void> : public FutureStateBase
+{
+public:
+	void setValue()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		assert(!m_ready);
+		complete(lock);
+	}
+
+	void take() {}
+};
+
+template <class T>
+class Promise;
+
+template <class T>
+class Future
+{
+public:
+	Future() = default;
+
+	bool valid() const {return m_state != nullptr;}
+	bool ready() const {return m_state->isReady();}
+	// 挂起直到完成 -> 不取出结果
+	void wait() const {m_state->wait();}
+	// 挂起直到完成并取出结果 -> 只能调用一次 异常在这里重新抛出
+	T get()
+	{
+		std::shared_ptr<FutureState<T>> state = std::move(m_state);
+		state->wait();
+		state->rethrow();
+		return state->take();
+	}
+	// 完成时回调 -> 在完成方的线程上执行 已完成则立即在当前线程执行
+	void onReady(std::function<void()> cb) const {m_state->onReady(std::move(cb));}
+
+private:
+	explicit Future(std::shared_ptr<FutureState<T>> state): m_state(std::move(state)) {}
+
+	std::shared_ptr<FutureState<T>> m_state;
+
+	friend class Promise<T>;
+};
+
+template <class T>
+class Promise
+{
+public:
+	Promise(): m_state(std::make_shared<FutureState<T>>()) {}
+	Promise(Promise&&) = default;
+	Promise& operator=(Promise&&) = default;
+
+	// 没有设置结果就销毁 -> 等待方收到broken_promise
+	~Promise()
+	{
+		if(m_state && !m_state->isReady())
+		{
+			m_state->setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+		}
+	}
+
+	Future<T> getFuture() {return Future<T>(m_state);}
+
+	template <class... Args>
+	void setValue(Args&&... args) {m_state->setValue(std::forward<Args>(args)...);}
+	void setException(std::exception_ptr exception) {m_state->setException(exception);}
+
+private:
+	std::shared_ptr<FutureState<T>> m_state;
+};
+
+// 在调度器中启动一个协程运行fn -> 返回它的结果 fn抛出的异常由Future::get()重新抛出
+// 默认使用当前的调度器 新协程继承调用方的截止时间
+template <class F>
+Future<std::invoke_result_t<F>> go(F fn, Scheduler* scheduler = Scheduler::GetThis())
+{
+	typedef std::invoke_result_t<F> R;
+	assert(scheduler != nullptr);
+
+	auto promise = std::make_shared<Promise<R>>();
+	Future<R> future = promise->getFuture();
+	Fiber::Deadline deadline = Fiber::GetDeadline();
+	scheduler->scheduleLock(std::function<void()>([promise, fn, deadline]() mutable
+	{
+		DeadlineScope scope(deadline);
+		try
+		{
+			if constexpr (std::is_void_v<R>)
+			{
+				fn();
+				promise->setValue();
+			}
+			else
+			{
+				promise->setValue(fn());
+			}
+		}
+		catch(...)
+		{
+			promise->setException(std::current_exception());
+		}
+	}));
+	return future;
+}
+
+// 全部完成时完成 -> 不取出结果 之后对每个Future调用get()
+template <class T>
+Future<void> when_all(const std::vector<Future<T>>& futures)
+{
+	auto promise = std::make_shared<Promise<void>>();
+	Future<void> future = promise->getFuture();
+	// 多算一个 -> 注册完所有回调之前不会完成
+	auto remaining = std::make_shared<std::atomic<size_t>>(futures.size() + 1);
+	auto arrive = [promise, remaining]()
+	{
+		if(--*remaining == 0)
+		{
+			promise->setValue();
+		}
+	};
+	for(const auto& f : futures)
+	{
+		f.onReady(arrive);
+	}
+	arrive();
+	return future;
+}
+
+// 任意一个完成时完成 -> 结果为它在futures中的下标
+template <class T>
+Future<size_t> when_any(const std::vector<Future<T>>& futures)
+{
+	assert(!futures.empty());
+	auto promise = std::make_shared<Promise<size_t>>();
+	Future<size_t> future = promise->getFuture();
+	auto done = std::make_shared<std::atomic<bool>>(false);
+	for(size_t i=0;i<futures.size();i++)
+	{
+		futures[i].onReady([promise, done, i]()
+		{
+			if(!done->exchange(true))
+			{
+				promise->setValue(i);
+			}
+		});
+	}
+	return future;
+}
+
+}
+
+#endif
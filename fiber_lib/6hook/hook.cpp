@@ -5,6 +5,7 @@
 #include <cstdarg>
 #include "fd_manager.h"
 #include <string.h>
+#include <poll.h>
 
 // apply XX to all functions
 #define HOOK_FUN(XX) \
@@ -45,6 +46,13 @@ void set_hook_enable(bool flag)
     t_hook_enable = flag;
 }
 
+static std::atomic<uint64_t> s_skipped_syscalls = {0};
+
+uint64_t get_skipped_syscalls()
+{
+    return s_skipped_syscalls;
+}
+
 void hook_init()
 {
 	static bool is_inited = false;
@@ -76,10 +84,180 @@ static HookIniter s_hook_initer;
 
 } // end namespace sylar
 
-struct timer_info 
+// i/o timeouts don't need to be exact -> 0.1% of the timeout like select()/poll() in the kernel,
+// at least the default 50us timer slack and at most 100ms
+static std::chrono::microseconds timeout_slack(uint64_t timeout_ms)
 {
-    int cancelled = 0;
-};
+    return std::chrono::microseconds(std::min<uint64_t>(std::max<uint64_t>(timeout_ms, 50), 100 * 1000));
+}
+
+// the current fiber's deadline caps a wait of timeout_ms -> false once it has passed
+static bool clamp_to_deadline(uint64_t& timeout_ms)
+{
+    sylar::Fiber::Deadline deadline = sylar::Fiber::GetDeadline();
+    if(deadline == sylar::Fiber::Deadline::max()) 
+    {
+        return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if(now >= deadline) 
+    {
+        return false;
+    }
+    // round up -> don't wake just before the deadline only to park again
+    uint64_t left = std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count();
+    timeout_ms = std::min(timeout_ms, left);
+    return true;
+}
+
+// errno is thread local and __errno_location() is declared const -> the compiler may keep its address across
+// a yield, but the fiber can resume on another worker; after a yield touch errno only through these two
+__attribute__((noinline)) static int get_errno()
+{
+    return errno;
+}
+
+__attribute__((noinline)) static void set_errno(int error)
+{
+    errno = error;
+}
+
+// io_uring -> fill the sqe of the operation, false if it has no io_uring equivalent
+template<typename OriginFun, typename... Args>
+static bool prep_uring(io_uring_sqe&, OriginFun, int, Args...) 
+{
+    return false;
+}
+
+static void prep_uring_rw(io_uring_sqe& sqe, int opcode, int fd, const void* addr, unsigned len, uint64_t off) 
+{
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = opcode;
+    sqe.fd     = fd;
+    sqe.addr   = (uint64_t)addr;
+    sqe.len    = len;
+    sqe.off    = off;
+}
+
+static bool prep_uring(io_uring_sqe& sqe, read_fun, int fd, void* buf, size_t count) 
+{
+    // off -1 -> the current file position
+    prep_uring_rw(sqe, IORING_OP_READ, fd, buf, count, (uint64_t)-1);
+    return true;
+}
+
+static bool prep_uring(io_uring_sqe& sqe, write_fun, int fd, const void* buf, size_t count) 
+{
+    prep_uring_rw(sqe, IORING_OP_WRITE, fd, buf, count, (uint64_t)-1);
+    return true;
+}
+
+// readv_fun and writev_fun are the same type
+static bool prep_uring(io_uring_sqe& sqe, readv_fun fun, int fd, const struct iovec* iov, int iovcnt) 
+{
+    prep_uring_rw(sqe, fun == readv_f ? IORING_OP_READV : IORING_OP_WRITEV, fd, iov, iovcnt, (uint64_t)-1);
+    return true;
+}
+
+static bool prep_uring(io_uring_sqe& sqe, recv_fun, int fd, void* buf, size_t len, int flags) 
+{
+    prep_uring_rw(sqe, IORING_OP_RECV, fd, buf, len, 0);
+    sqe.msg_flags = flags;
+    return true;
+}
+
+static bool prep_uring(io_uring_sqe& sqe, send_fun, int fd, const void* buf, size_t len, int flags) 
+{
+    prep_uring_rw(sqe, IORING_OP_SEND, fd, buf, len, 0);
+    sqe.msg_flags = flags;
+    return true;
+}
+
+static bool prep_uring(io_uring_sqe& sqe, recvmsg_fun, int fd, struct msghdr* msg, int flags) 
+{
+    prep_uring_rw(sqe, IORING_OP_RECVMSG, fd, msg, 1, 0);
+    sqe.msg_flags = flags;
+    return true;
+}
+
+static bool prep_uring(io_uring_sqe& sqe, sendmsg_fun, int fd, const struct msghdr* msg, int flags) 
+{
+    prep_uring_rw(sqe, IORING_OP_SENDMSG, fd, msg, 1, 0);
+    sqe.msg_flags = flags;
+    return true;
+}
+
+static bool prep_uring(io_uring_sqe& sqe, accept_fun, int fd, struct sockaddr* addr, socklen_t* addrlen) 
+{
+    prep_uring_rw(sqe, IORING_OP_ACCEPT, fd, addr, 0, 0);
+    sqe.addr2 = (uint64_t)addrlen;
+    return true;
+}
+
+// bytes requested by the operation -> 0 unknown
+// a stream socket that transfers less than this is drained in that direction
+template<typename OriginFun, typename... Args>
+static size_t io_length(OriginFun, Args...) 
+{
+    return 0;
+}
+
+static size_t io_length(read_fun, void*, size_t count) 
+{
+    return count;
+}
+
+static size_t io_length(write_fun, const void*, size_t count) 
+{
+    return count;
+}
+
+static size_t iov_length(const struct iovec* iov, size_t iovcnt) 
+{
+    size_t len = 0;
+    for (size_t i = 0; i < iovcnt; ++i) 
+    {
+        len += iov[i].iov_len;
+    }
+    return len;
+}
+
+// readv_fun and writev_fun are the same type
+static size_t io_length(readv_fun, const struct iovec* iov, int iovcnt) 
+{
+    return iov_length(iov, iovcnt);
+}
+
+// MSG_PEEK leaves the data in the socket
+static size_t io_length(recv_fun, void*, size_t len, int flags) 
+{
+    return flags & MSG_PEEK ? 0 : len;
+}
+
+static size_t io_length(recvfrom_fun, void*, size_t len, int flags, struct sockaddr*, socklen_t*) 
+{
+    return flags & MSG_PEEK ? 0 : len;
+}
+
+static size_t io_length(recvmsg_fun, struct msghdr* msg, int flags) 
+{
+    return flags & MSG_PEEK ? 0 : iov_length(msg->msg_iov, msg->msg_iovlen);
+}
+
+static size_t io_length(send_fun, const void*, size_t len, int) 
+{
+    return len;
+}
+
+static size_t io_length(sendto_fun, const void*, size_t len, int, const struct sockaddr*, socklen_t) 
+{
+    return len;
+}
+
+static size_t io_length(sendmsg_fun, const struct msghdr* msg, int) 
+{
+    return iov_length(msg->msg_iov, msg->msg_iovlen);
+}
 
 // universal template for read and write function
 template<typename OriginFun, typename... Args>
@@ -90,12 +268,15 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
     if(!ctx) 
     {
         return fun(fd, std::forward<Args>(args)...);
     }
 
+    // close() on another thread bumps it and the slot may then be reset for a new fd with this number
+    // -> compared after every resume instead of trusting ctx
+    uint64_t generation = ctx->getGeneration();
     if(ctx->isClosed()) 
     {
         errno = EBADF;
@@ -109,41 +290,86 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name, uint32_t
 
     // get the timeout
     uint64_t timeout = ctx->getTimeout(timeout_so);
-    // timer condition
-    std::shared_ptr<timer_info> tinfo(new timer_info);
 
 retry:
-	// run the function
-    ssize_t n = fun(fd, std::forward<Args>(args)...);
-    
-    // EINTR ->Operation interrupted by system ->retry
-    while(n == -1 && errno == EINTR) 
+    ssize_t n = -1;
+    if(ctx->isDrained(event)) 
+    {
+        // the last transfer emptied the socket -> park right away, the reactor resumes us on the next edge
+        ctx->setDrained(event, false);
+        ++sylar::s_skipped_syscalls;
+        set_errno(EAGAIN);
+    }
+    else 
     {
+        // run the function
         n = fun(fd, std::forward<Args>(args)...);
+
+        // EINTR ->Operation interrupted by system ->retry
+        while(n == -1 && get_errno() == EINTR) 
+        {
+            n = fun(fd, std::forward<Args>(args)...);
+        }
+
+        // short transfer -> nothing left to read / no room left to write
+        if(n > 0 && ctx->isStream() && (size_t)n < io_length(fun, args...)) 
+        {
+            ctx->setDrained(event, true);
+        }
     }
     
     // 0 resource was temporarily unavailable -> retry until ready 
-    if(n == -1 && errno == EAGAIN) 
+    if(n == -1 && get_errno() == EAGAIN) 
     {
         sylar::IOManager* iom = sylar::IOManager::GetThis();
-        // timer
-        std::shared_ptr<sylar::Timer> timer;
-        std::weak_ptr<timer_info> winfo(tinfo);
 
-        // 1 timeout has been set -> add a conditional timer for canceling this operation
-        if(timeout != (uint64_t)-1) 
+        // the fiber's deadline may come before the fd's timeout -> checked again before every wait
+        uint64_t wait_ms = timeout;
+        if(!clamp_to_deadline(wait_ms)) 
+        {
+            set_errno(ETIMEDOUT);
+            return -1;
+        }
+
+        // io_uring -> submit the operation itself and resume with its result
+        // not on a shared stack: buffers on it would be filled by the kernel while another fiber owns it -> epoll below
+        io_uring_sqe sqe;
+        if(iom->getReactor() == sylar::IOManager::IO_URING && !sylar::Fiber::IsOnSharedStack() && prep_uring(sqe, fun, fd, std::forward<Args>(args)...)) 
         {
-            timer = iom->addConditionTimer(timeout, [winfo, fd, iom, event]() 
+            int res = iom->submitIo(sqe, wait_ms);
+            // -ENOTSUP: not on a worker thread, -EAGAIN: the kernel doesn't wait on nonblocking fds,
+            // -EBUSY: the submission queue is full -> epoll below
+            if(res != -ENOTSUP && res != -EAGAIN && res != -EBUSY) 
             {
-                auto t = winfo.lock();
-                if(!t || t->cancelled) 
+                if(res >= 0) 
                 {
-                    return;
+                    if(res > 0 && ctx->getGeneration() == generation && ctx->isStream() && (size_t)res < io_length(fun, args...)) 
+                    {
+                        ctx->setDrained(event, true);
+                    }
+                    return res;
                 }
-                t->cancelled = ETIMEDOUT;
+                // EBADF -> canceled by close(), ECANCELED -> by Fiber::cancel()
+                set_errno(-res);
+                return -1;
+            }
+        }
+        // set by the timer or Fiber::cancel() -> both wait for a running callback before we return,
+        // off a shared stack since they write it while this fiber is parked
+        sylar::OffStack<std::atomic<int>> cancelled(0);
+        std::atomic<int>* reason = cancelled.get();
+        // timer -> pooled with an inline callback, no allocation
+        sylar::TimerHandle timer;
+
+        // 1 timeout or deadline has been set -> add a timer for canceling this operation
+        if(wait_ms != (uint64_t)-1) 
+        {
+            timer = iom->addInlineTimer(std::chrono::milliseconds(wait_ms), [reason, fd, iom, event]() 
+            {
+                *reason = ETIMEDOUT;
                 // cancel this event and trigger once to return to this fiber
                 iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
-            }, winfo);
+            }, timeout_slack(wait_ms));
         }
 
         // 2 add event -> callback is this fiber
@@ -151,25 +377,38 @@ retry:
         if(rt) 
         {
             std::cout << hook_fun_name << " addEvent("<< fd << ", " << event << ")";
-            if(timer) 
-            {
-                timer->cancel();
-            }
+            timer.cancel();
             return -1;
         } 
         else 
         {
-            sylar::Fiber::GetThis()->yield();
-     
-            // 3 resume either by addEvent or cancelEvent
-            if(timer) 
+            // 3 Fiber::cancel() -> the same way out as the timeout
+            sylar::Fiber* fiber = sylar::Fiber::GetThis().get();
+            auto on_cancel = [reason, fd, iom, event]() 
+            {
+                *reason = ECANCELED;
+                iom->cancelEvent(fd, (sylar::IOManager::Event)(event));
+            };
+            if(!fiber->setCancelHook(on_cancel)) 
             {
-                timer->cancel();
+                on_cancel();
             }
+
+            fiber->yield();
+     
+            // 4 resume either by addEvent or cancelEvent
+            fiber->clearCancelHook();
+            timer.cancel();
             // by cancelEvent
-            if(tinfo->cancelled == ETIMEDOUT) 
+            if(*reason) 
             {
-                errno = tinfo->cancelled;
+                set_errno(*reason);
+                return -1;
+            }
+            // closed while we were parked -> ctx may already describe another fd
+            if(ctx->getGeneration() != generation) 
+            {
+                set_errno(EBADF);
                 return -1;
             }
             goto retry;
@@ -180,6 +419,72 @@ retry:
 
 
 
+// park the current fiber for timeout -> Fiber::cancel() wakes it early, the fiber's deadline cuts it short
+// 0 after sleeping the whole time, -1 with errno = ECANCELED / ETIMEDOUT and the time left in *left otherwise
+static int sleep_fiber(std::chrono::microseconds timeout, std::chrono::microseconds* left)
+{
+    std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
+    sylar::IOManager* iom = sylar::IOManager::GetThis();
+    auto start = std::chrono::steady_clock::now();
+
+    std::chrono::microseconds wait = timeout;
+    sylar::Fiber::Deadline deadline = fiber->getDeadline();
+    bool expires = deadline != sylar::Fiber::Deadline::max() && deadline - start < timeout;
+    if(expires) 
+    {
+        wait = std::max(std::chrono::ceil<std::chrono::microseconds>(deadline - start), std::chrono::microseconds(0));
+    }
+
+    // the timer and Fiber::cancel() race to reschedule us -> only the first one does
+    // both touch it while we are parked -> off a shared stack
+    struct SleepState
+    {
+        std::shared_ptr<sylar::Fiber> fiber;
+        std::atomic<bool> woken = {false};
+        bool cancelled = false;
+    };
+    sylar::OffStack<SleepState> state;
+    state->fiber = fiber;
+    SleepState* sleeping = state.get();
+    sylar::TimerHandle timer = iom->addInlineTimer(wait, [sleeping, iom]() 
+    {
+        if(!sleeping->woken.exchange(true)) 
+        {
+            iom->scheduleLock(sleeping->fiber);
+        }
+    });
+    auto on_cancel = [sleeping, iom]() 
+    {
+        if(!sleeping->woken.exchange(true)) 
+        {
+            sleeping->cancelled = true;
+            iom->scheduleLock(sleeping->fiber);
+        }
+    };
+    if(!fiber->setCancelHook(on_cancel)) 
+    {
+        on_cancel();
+    }
+
+    // wait for the next resume
+    fiber->yield();
+    fiber->clearCancelHook();
+    timer.cancel();
+
+    bool cancelled = state->cancelled;
+    if(!cancelled && !expires) 
+    {
+        return 0;
+    }
+    if(left) 
+    {
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        *left = std::max(timeout - elapsed, std::chrono::microseconds(0));
+    }
+    set_errno(cancelled ? ECANCELED : ETIMEDOUT);
+    return -1;
+}
+
 extern "C"{
 
 // declaration -> sleep_fun sleep_f = nullptr;
@@ -195,13 +500,13 @@ unsigned int sleep(unsigned int seconds)
 		return sleep_f(seconds);
 	}
 
-	std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-	sylar::IOManager* iom = sylar::IOManager::GetThis();
-	// add a timer to reschedule this fiber
-	iom->addTimer(seconds*1000, [fiber, iom](){iom->scheduleLock(fiber, -1);});
-	// wait for the next resume
-	fiber->yield();
-	return 0;
+	std::chrono::microseconds left;
+	if(sleep_fiber(std::chrono::seconds(seconds), &left) == 0)
+	{
+		return 0;
+	}
+	// canceled or past the deadline -> the seconds not slept, at least 1
+	return std::max<uint64_t>(1, (left.count() + 999999) / 1000000);
 }
 
 int usleep(useconds_t usec)
@@ -211,13 +516,7 @@ int usleep(useconds_t usec)
 		return usleep_f(usec);
 	}
 
-	std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-	sylar::IOManager* iom = sylar::IOManager::GetThis();
-	// add a timer to reschedule this fiber
-	iom->addTimer(usec/1000, [fiber, iom](){iom->scheduleLock(fiber);});
-	// wait for the next resume
-	fiber->yield();
-	return 0;
+	return sleep_fiber(std::chrono::microseconds(usec), nullptr);
 }
 
 int nanosleep(const struct timespec* req, struct timespec* rem)
@@ -227,15 +526,17 @@ int nanosleep(const struct timespec* req, struct timespec* rem)
 		return nanosleep_f(req, rem);
 	}	
 
-	int timeout_ms = req->tv_sec*1000 + req->tv_nsec/1000/1000;
+	// round up -> never wake before the requested time
+	std::chrono::microseconds timeout(req->tv_sec*1000000 + (req->tv_nsec + 999)/1000);
 
-	std::shared_ptr<sylar::Fiber> fiber = sylar::Fiber::GetThis();
-	sylar::IOManager* iom = sylar::IOManager::GetThis();
-	// add a timer to reschedule this fiber
-	iom->addTimer(timeout_ms, [fiber, iom](){iom->scheduleLock(fiber, -1);});
-	// wait for the next resume
-	fiber->yield();	
-	return 0;
+	std::chrono::microseconds left;
+	int rt = sleep_fiber(timeout, &left);
+	if(rt && rem)
+	{
+		rem->tv_sec = left.count() / 1000000;
+		rem->tv_nsec = left.count() % 1000000 * 1000;
+	}
+	return rt;
 }
 
 int socket(int domain, int type, int protocol)
@@ -252,6 +553,12 @@ int socket(int domain, int type, int protocol)
 		return fd;
 	}
 	sylar::FdMgr::GetInstance()->get(fd, true);
+	// the number may have belonged to an fd closed without the hook
+	sylar::IOManager* iom = sylar::IOManager::GetThis();
+	if(iom)
+	{
+		iom->resetFd(fd);
+	}
 	return fd;
 }
 
@@ -262,7 +569,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
-    std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+    sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
     if(!ctx || ctx->isClosed()) 
     {
         errno = EBADF;
@@ -291,50 +598,82 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return n;
     }
 
+    // the fiber's deadline may come before timeout_ms
+    if(!clamp_to_deadline(timeout_ms)) 
+    {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
     // wait for write event is ready -> connect succeeds
     sylar::IOManager* iom = sylar::IOManager::GetThis();
-    std::shared_ptr<sylar::Timer> timer;
-    std::shared_ptr<timer_info> tinfo(new timer_info);
-    std::weak_ptr<timer_info> winfo(tinfo);
 
-    if(timeout_ms != (uint64_t)-1) 
+    // io_uring -> poll for POLLOUT on the ring
+    bool polled = false;
+    if(iom->getReactor() == sylar::IOManager::IO_URING) 
     {
-        timer = iom->addConditionTimer(timeout_ms, [winfo, fd, iom]() 
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode        = IORING_OP_POLL_ADD;
+        sqe.fd            = fd;
+        sqe.poll32_events = POLLOUT;
+        int res = iom->submitIo(sqe, timeout_ms);
+        // -ENOTSUP / -EBUSY -> epoll below
+        if(res < 0 && res != -ENOTSUP && res != -EBUSY) 
         {
-            auto t = winfo.lock();
-            if(!t || t->cancelled) 
-            {
-                return;
-            }
-            t->cancelled = ETIMEDOUT;
-            iom->cancelEvent(fd, sylar::IOManager::WRITE);
-        }, winfo);
+            set_errno(-res);
+            return -1;
+        }
+        polled = res >= 0;
     }
 
-    int rt = iom->addEvent(fd, sylar::IOManager::WRITE);
-    if(rt == 0) 
+    if(!polled) 
     {
-        sylar::Fiber::GetThis()->yield();
+        sylar::TimerHandle timer;
+        // written while we are parked -> off a shared stack
+        sylar::OffStack<std::atomic<int>> cancelled(0);
+        std::atomic<int>* reason = cancelled.get();
 
-        // resume either by addEvent or cancelEvent
-        if(timer) 
+        if(timeout_ms != (uint64_t)-1) 
         {
-            timer->cancel();
+            timer = iom->addInlineTimer(std::chrono::milliseconds(timeout_ms), [reason, fd, iom]() 
+            {
+                *reason = ETIMEDOUT;
+                iom->cancelEvent(fd, sylar::IOManager::WRITE);
+            }, timeout_slack(timeout_ms));
         }
 
-        if(tinfo->cancelled) 
+        int rt = iom->addEvent(fd, sylar::IOManager::WRITE);
+        if(rt == 0) 
         {
-            errno = tinfo->cancelled;
-            return -1;
-        }
-    } 
-    else 
-    {
-        if(timer) 
+            sylar::Fiber* fiber = sylar::Fiber::GetThis().get();
+            auto on_cancel = [reason, fd, iom]() 
+            {
+                *reason = ECANCELED;
+                iom->cancelEvent(fd, sylar::IOManager::WRITE);
+            };
+            if(!fiber->setCancelHook(on_cancel)) 
+            {
+                on_cancel();
+            }
+
+            fiber->yield();
+
+            // resume either by addEvent or cancelEvent
+            fiber->clearCancelHook();
+            timer.cancel();
+
+            if(*reason) 
+            {
+                set_errno(*reason);
+                return -1;
+            }
+        } 
+        else 
         {
-            timer->cancel();
+            timer.cancel();
+            std::cerr << "connect addEvent(" << fd << ", WRITE) error";
         }
-        std::cerr << "connect addEvent(" << fd << ", WRITE) error";
     }
 
     // check out if the connection socket established 
@@ -350,7 +689,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     } 
     else 
     {
-        errno = error;
+        set_errno(error);
         return -1;
     }
 }
@@ -368,6 +707,11 @@ int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 	if(fd>=0)
 	{
 		sylar::FdMgr::GetInstance()->get(fd, true);
+		sylar::IOManager* iom = sylar::IOManager::GetThis();
+		if(iom)
+		{
+			iom->resetFd(fd);
+		}
 	}
 	return fd;
 }
@@ -429,17 +773,17 @@ int close(int fd)
 		return close_f(fd);
 	}	
 
-	std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+	sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
 
 	if(ctx)
 	{
+		// del fdctx first -> fibers woken by cancelAll() see the new generation instead of parking on fd again
+		sylar::FdMgr::GetInstance()->del(fd);
 		auto iom = sylar::IOManager::GetThis();
 		if(iom)
 		{	
 			iom->cancelAll(fd);
 		}
-		// del fdctx
-		sylar::FdMgr::GetInstance()->del(fd);
 	}
 	return close_f(fd);
 }
@@ -455,7 +799,7 @@ int fcntl(int fd, int cmd, ... /* arg */ )
             {
                 int arg = va_arg(va, int); // Access the next int argument
                 va_end(va);
-                std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+                sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
                 if(!ctx || ctx->isClosed() || !ctx->isSocket()) 
                 {
                     return fcntl_f(fd, cmd, arg);
@@ -479,7 +823,7 @@ int fcntl(int fd, int cmd, ... /* arg */ )
             {
                 va_end(va);
                 int arg = fcntl_f(fd, cmd);
-                std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+                sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
                 if(!ctx || ctx->isClosed() || !ctx->isSocket()) 
                 {
                     return arg;
@@ -562,7 +906,7 @@ int ioctl(int fd, unsigned long request, ...)
     if(FIONBIO == request) 
     {
         bool user_nonblock = !!*(int*)arg;
-        std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(fd);
+        sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(fd);
         if(!ctx || ctx->isClosed() || !ctx->isSocket()) 
         {
             return ioctl_f(fd, request, arg);
@@ -588,7 +932,7 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
     {
         if(optname == SO_RCVTIMEO || optname == SO_SNDTIMEO) 
         {
-            std::shared_ptr<sylar::FdCtx> ctx = sylar::FdMgr::GetInstance()->get(sockfd);
+            sylar::FdCtx* ctx = sylar::FdMgr::GetInstance()->get(sockfd);
             if(ctx) 
             {
                 const timeval* v = (const timeval*)optval;
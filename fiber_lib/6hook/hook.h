@@ -7,12 +7,16 @@
 #include <sys/uio.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <cstdint>
 
 namespace sylar{
 
 bool is_hook_enable();
 void set_hook_enable(bool flag);
 
+// hooked io calls skipped because the socket was known to be drained
+uint64_t get_skipped_syscalls();
+
 }
 
 extern "C"
@@ -1,7 +1,11 @@
 #include <unistd.h>    
 #include <sys/epoll.h> 
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <fcntl.h>     
+#include <sys/syscall.h>
 #include <cstring>
+#include <chrono>
 
 #include "ioscheduler.h"
 
@@ -9,6 +13,57 @@ static bool debug = false;
 
 namespace sylar {
 
+// epoll_wait with a microsecond timeout, ~0ull -> wait forever
+// epoll_pwait2 (5.11+) takes a timespec, older kernels round up to the next millisecond
+static int epoll_wait_us(int epfd, epoll_event* events, int maxevents, uint64_t timeout_us)
+{
+    if (timeout_us == ~0ull) 
+    {
+        return epoll_wait(epfd, events, maxevents, -1);
+    }
+
+#ifdef SYS_epoll_pwait2
+    static std::atomic<bool> s_hasPwait2 = {true};
+    if (s_hasPwait2) 
+    {
+        timespec ts;
+        ts.tv_sec  = timeout_us / 1000000;
+        ts.tv_nsec = timeout_us % 1000000 * 1000;
+        int rt = (int)syscall(SYS_epoll_pwait2, epfd, events, maxevents, &ts, nullptr, 0);
+        if (rt >= 0 || errno != ENOSYS) 
+        {
+            return rt;
+        }
+        s_hasPwait2 = false;
+    }
+#endif
+    return epoll_wait(epfd, events, maxevents, (int)((timeout_us + 999) / 1000));
+}
+
+// park on a blocking eventfd with a microsecond timeout, ~0ull -> wait forever
+static void park_us(int fd, uint64_t timeout_us)
+{
+    pollfd pfd;
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    timespec ts;
+    ts.tv_sec  = timeout_us / 1000000;
+    ts.tv_nsec = timeout_us % 1000000 * 1000;
+
+    int rt = ppoll(&pfd, 1, timeout_us == ~0ull ? nullptr : &ts, nullptr);
+    if (rt > 0) 
+    {
+        // readable -> a single read resets the counter without blocking
+        uint64_t dummy;
+        rt = read(fd, &dummy, sizeof(dummy));
+    }
+    (void)rt;
+}
+
+// the manager whose timer shard the current thread serves -> set once the worker enters idle()
+// a worker that has not been idle yet (e.g. the caller thread before stop()) inserts remotely
+static thread_local IOManager* t_timer_owner = nullptr;
+
 IOManager* IOManager::GetThis() 
 {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
@@ -35,7 +90,7 @@ void IOManager::FdContext::resetEventContext(EventContext &ctx)
 }
 
 // no lock
-void IOManager::FdContext::triggerEvent(IOManager::Event event) {
+void IOManager::FdContext::triggerEvent(IOManager::Event event, int thread) {
     assert(events & event);
 
     // delete event 
@@ -46,12 +101,17 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     if (ctx.cb) 
     {
         // call ScheduleTask(std::function<void()>* f, int thr)
-        ctx.scheduler->scheduleLock(&ctx.cb);
+        ctx.scheduler->scheduleLock(&ctx.cb, thread);
     } 
     else 
     {
+        // a shared-stack fiber must go back to its own thread
+        if (ctx.fiber->getBoundThread() != -1) 
+        {
+            thread = -1;
+        }
         // call ScheduleTask(std::shared_ptr<Fiber>* f, int thr)
-        ctx.scheduler->scheduleLock(&ctx.fiber);
+        ctx.scheduler->scheduleLock(&ctx.fiber, thread);
     }
 
     // reset event context
@@ -59,81 +119,106 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     return;
 }
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string &name): 
-Scheduler(threads, use_caller, name), TimerManager()
+IOManager::IOManager(size_t threads, bool use_caller, const std::string &name, QueueMode mode, Reactor reactor): 
+Scheduler(threads, use_caller, name, mode), TimerManager(threads), m_reactor(reactor), 
+m_fdContexts([](FdContext& fd_ctx, size_t fd) { fd_ctx.fd = fd; })
 {
     // create epoll fd
     m_epfd = epoll_create(5000);
     assert(m_epfd > 0);
 
-    // create pipe
-    int rt = pipe(m_tickleFds);
-    assert(!rt);
+    // create the poller's eventfd (non-blocked)
+    m_pollerFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    assert(m_pollerFd >= 0);
 
     // add read event to epoll
     epoll_event event;
     event.events  = EPOLLIN | EPOLLET; // Edge Triggered
-    event.data.fd = m_tickleFds[0];
-
-    // non-blocked
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    assert(!rt);
+    event.data.fd = m_pollerFd;
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
+    int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_pollerFd, &event);
     assert(!rt);
 
-    contextResize(32);
+    // one ring per worker -> fall back to epoll if io_uring is not available
+    std::vector<std::unique_ptr<Uring>> rings;
+    if (m_reactor == IO_URING) 
+    {
+        for (size_t i = 0; i < getWorkerCount(); ++i) 
+        {
+            rings.emplace_back(new Uring());
+            // close() cancels the fd's operations by fd -> IORING_ASYNC_CANCEL_FD
+            if (!rings.back()->init(URING_ENTRIES) || !rings.back()->canCancelFd()) 
+            {
+                std::cerr << "IOManager: io_uring is not available or can't cancel by fd (5.19+), falling back to epoll" << std::endl;
+                m_reactor = EPOLL;
+                rings.clear();
+                break;
+            }
+        }
+    }
 
-    start();
-}
+    // one blocking eventfd per worker to park on
+    m_wakers.resize(getWorkerCount());
+    for (size_t i = 0; i < m_wakers.size(); ++i) 
+    {
+        m_wakers[i].reset(new Waker());
+        m_wakers[i]->fd = eventfd(0, EFD_CLOEXEC);
+        assert(m_wakers[i]->fd >= 0);
 
-IOManager::~IOManager() {
-    stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
+        if (isSharded()) 
+        {
+            // the worker's own epoll -> its fds and its eventfd
+            m_wakers[i]->epfd = epoll_create(5000);
+            assert(m_wakers[i]->epfd > 0);
+
+            event.events  = EPOLLIN | EPOLLET;
+            event.data.fd = m_wakers[i]->fd;
+            rt = epoll_ctl(m_wakers[i]->epfd, EPOLL_CTL_ADD, m_wakers[i]->fd, &event);
+            assert(!rt);
+        }
 
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) 
-    {
-        if (m_fdContexts[i]) 
+        if (m_reactor == IO_URING) 
         {
-            delete m_fdContexts[i];
+            // readable while completions are pending -> level triggered
+            m_wakers[i]->ring.swap(rings[i]);
+            event.events  = EPOLLIN;
+            event.data.fd = m_wakers[i]->ring->getFd();
+            rt = epoll_ctl(m_wakers[i]->epfd, EPOLL_CTL_ADD, m_wakers[i]->ring->getFd(), &event);
+            assert(!rt);
         }
     }
-}
 
-// no lock
-void IOManager::contextResize(size_t size) 
-{
-    m_fdContexts.resize(size);
+    // worker threads serve their timer shards from now on, the caller (index 0) only in stop()
+    // -> timers handed out before a worker first goes idle must not land on the caller's shard
+    for (size_t i = use_caller ? 1 : 0; i < getWorkerCount(); ++i) 
+    {
+        activateShard(i);
+    }
+
+    start();
+}
 
-    for (size_t i = 0; i < m_fdContexts.size(); ++i) 
+IOManager::~IOManager() {
+    stop();
+    close(m_epfd);
+    close(m_pollerFd);
+    for (auto& waker : m_wakers) 
     {
-        if (m_fdContexts[i]==nullptr) 
+        close(waker->fd);
+        if (waker->epfd >= 0) 
         {
-            m_fdContexts[i] = new FdContext();
-            m_fdContexts[i]->fd = i;
+            close(waker->epfd);
         }
     }
 }
 
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) 
 {
-    // attemp to find FdContext 
-    FdContext *fd_ctx = nullptr;
-    
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) 
-    {
-        fd_ctx = m_fdContexts[fd];
-        read_lock.unlock();
-    }
-    else 
+    // attemp to find FdContext -> created on first use
+    FdContext *fd_ctx = m_fdContexts.getOrCreate(fd);
+    if (!fd_ctx) 
     {
-        read_lock.unlock();
-        std::unique_lock<std::shared_mutex> write_lock(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+        return -1;
     }
 
     std::lock_guard<std::mutex> lock(fd_ctx->mutex);
@@ -144,17 +229,33 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
         return -1;
     }
 
-    // add new event
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
+    // sharded -> bind the fd to the worker registering it, or spread fds registered from outside
+    if (isSharded() && fd_ctx->owner == -1) 
+    {
+        int index = getWorkerIndex();
+        fd_ctx->owner = index != -1 ? index : m_nextShard++ % m_wakers.size();
+    }
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) 
+    // add new event -> persistent mode only touches epoll the first time
+    if (!m_persistent || !fd_ctx->registered) 
     {
-        std::cerr << "addEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
-        return -1;
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events   = m_persistent ? EPOLLET | EPOLLIN | EPOLLOUT : EPOLLET | fd_ctx->events | event;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(getEpfd(fd_ctx), op, fd, &epevent);
+        // the fd with the pending events was closed without cancelAll() -> this number is a new file
+        if (rt && op == EPOLL_CTL_MOD && errno == ENOENT) 
+        {
+            rt = epoll_ctl(getEpfd(fd_ctx), EPOLL_CTL_ADD, fd, &epevent);
+        }
+        if (rt) 
+        {
+            std::cerr << "addEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
+            return -1;
+        }
+        fd_ctx->registered = m_persistent;
     }
 
     ++m_pendingEventCount;
@@ -175,22 +276,22 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
         event_ctx.fiber = Fiber::GetThis();
         assert(event_ctx.fiber->getState() == Fiber::RUNNING);
     }
+
+    // the edge fired before we got here and won't fire again -> trigger now
+    if (fd_ctx->ready & event) 
+    {
+        fd_ctx->ready &= ~event;
+        fd_ctx->triggerEvent(event, getOwnerThread(fd_ctx));
+        --m_pendingEventCount;
+    }
     return 0;
 }
 
 bool IOManager::delEvent(int fd, Event event) {
     // attemp to find FdContext 
-    FdContext *fd_ctx = nullptr;
-    
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) 
-    {
-        fd_ctx = m_fdContexts[fd];
-        read_lock.unlock();
-    }
-    else 
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) 
     {
-        read_lock.unlock();
         return false;
     }
 
@@ -202,18 +303,21 @@ bool IOManager::delEvent(int fd, Event event) {
         return false;
     }
 
-    // delete the event
+    // delete the event -> persistent mode keeps the registration
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op           = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) 
+    if (!fd_ctx->registered) 
     {
-        std::cerr << "delEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
-        return -1;
+        int op           = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events   = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(getEpfd(fd_ctx), op, fd, &epevent);
+        if (rt) 
+        {
+            std::cerr << "delEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
+            return -1;
+        }
     }
 
 
@@ -230,17 +334,9 @@ bool IOManager::delEvent(int fd, Event event) {
 
 bool IOManager::cancelEvent(int fd, Event event) {
     // attemp to find FdContext 
-    FdContext *fd_ctx = nullptr;
-    
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) 
-    {
-        fd_ctx = m_fdContexts[fd];
-        read_lock.unlock();
-    }
-    else 
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) 
     {
-        read_lock.unlock();
         return false;
     }
 
@@ -252,47 +348,58 @@ bool IOManager::cancelEvent(int fd, Event event) {
         return false;
     }
 
-    // delete the event
+    // delete the event -> persistent mode keeps the registration
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op           = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events   = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if (rt) 
+    if (!fd_ctx->registered) 
     {
-        std::cerr << "cancelEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
-        return -1;
+        int op           = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events   = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(getEpfd(fd_ctx), op, fd, &epevent);
+        if (rt) 
+        {
+            std::cerr << "cancelEvent::epoll_ctl failed: " << strerror(errno) << std::endl; 
+            return -1;
+        }
     }
 
     --m_pendingEventCount;
 
     // update fdcontext, event context and trigger
-    fd_ctx->triggerEvent(event);    
+    fd_ctx->triggerEvent(event, getOwnerThread(fd_ctx));    
     return true;
 }
 
 bool IOManager::cancelAll(int fd) {
     // attemp to find FdContext 
-    FdContext *fd_ctx = nullptr;
-    
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    if ((int)m_fdContexts.size() > fd) 
-    {
-        fd_ctx = m_fdContexts[fd];
-        read_lock.unlock();
-    }
-    else 
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) 
     {
-        read_lock.unlock();
         return false;
     }
 
     std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+
+    // called by close() -> the next fd with this number may bind to another worker
+    int epfd   = getEpfd(fd_ctx);
+    int thread = getOwnerThread(fd_ctx);
+    fd_ctx->owner = -1;
+
+    // io_uring operations hold their own reference to the file -> close() alone won't finish them
+    if (fd_ctx->rings) 
+    {
+        cancelIo(fd_ctx);
+    }
     
+    // persistent registration ends here -> the next fd with this number starts clean
+    bool registered = fd_ctx->registered;
+    fd_ctx->registered = false;
+    fd_ctx->ready = NONE;
+
     // none of events exist
-    if (!fd_ctx->events) 
+    if (!fd_ctx->events && !registered) 
     {
         return false;
     }
@@ -303,23 +410,28 @@ bool IOManager::cancelAll(int fd) {
     epevent.events   = 0;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+    int rt = epoll_ctl(epfd, op, fd, &epevent);
     if (rt) 
     {
         std::cerr << "IOManager::epoll_ctl failed: " << strerror(errno) << std::endl; 
         return -1;
     }
 
+    if (!fd_ctx->events) 
+    {
+        return false;
+    }
+
     // update fdcontext, event context and trigger
     if (fd_ctx->events & READ) 
     {
-        fd_ctx->triggerEvent(READ);
+        fd_ctx->triggerEvent(READ, thread);
         --m_pendingEventCount;
     }
 
     if (fd_ctx->events & WRITE) 
     {
-        fd_ctx->triggerEvent(WRITE);
+        fd_ctx->triggerEvent(WRITE, thread);
         --m_pendingEventCount;
     }
 
@@ -327,22 +439,257 @@ bool IOManager::cancelAll(int fd) {
     return true;
 }
 
+void IOManager::resetFd(int fd) 
+{
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) 
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+    // closing the old file removed it from epoll -> the next addEvent() registers again
+    fd_ctx->registered = false;
+    fd_ctx->ready = NONE;
+}
+
+bool IOManager::rebindFd(int fd, int index) 
+{
+    if (!isSharded() || index < 0 || index >= (int)m_wakers.size()) 
+    {
+        return false;
+    }
+
+    // attemp to find FdContext 
+    FdContext *fd_ctx = m_fdContexts.get(fd);
+    if (!fd_ctx) 
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+
+    if (fd_ctx->owner == index) 
+    {
+        return true;
+    }
+
+    // move the registration -> add to the new shard first, events that already fired in the old shard are skipped in idle()
+    if (fd_ctx->events || fd_ctx->registered) 
+    {
+        epoll_event epevent;
+        epevent.events   = fd_ctx->registered ? EPOLLET | EPOLLIN | EPOLLOUT : EPOLLET | fd_ctx->events;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epoll_ctl(m_wakers[index]->epfd, EPOLL_CTL_ADD, fd, &epevent);
+        if (rt) 
+        {
+            std::cerr << "rebindFd::epoll_ctl failed: " << strerror(errno) << std::endl; 
+            return false;
+        }
+        epoll_ctl(getEpfd(fd_ctx), EPOLL_CTL_DEL, fd, &epevent);
+    }
+
+    fd_ctx->owner = index;
+    return true;
+}
+
+int IOManager::submitIo(io_uring_sqe &sqe, uint64_t timeout_ms) 
+{
+    int index = getWorkerIndex();
+    if (m_reactor != IO_URING || index == -1) 
+    {
+        return -ENOTSUP;
+    }
+
+    // attemp to find FdContext -> created on first use
+    FdContext *fd_ctx = m_fdContexts.getOrCreate(sqe.fd);
+    if (!fd_ctx) 
+    {
+        return -EBADF;
+    }
+
+    OffStack<UringRequest> req;
+    req->fiber = Fiber::GetThis();
+    sqe.user_data = (uint64_t)req.get();
+
+    req->ts.tv_sec  = timeout_ms / 1000;
+    req->ts.tv_nsec = timeout_ms % 1000 * 1000000;
+    auto start = std::chrono::steady_clock::now();
+
+    {
+        // under the fd lock -> cancelAll() either sees this ring or runs before the submission
+        std::lock_guard<std::mutex> lock(fd_ctx->mutex);
+        ++m_pendingEventCount;
+        int rt = m_wakers[index]->ring->submit(sqe, timeout_ms == ~0ull ? nullptr : &req->ts);
+        if (rt) 
+        {
+            --m_pendingEventCount;
+            return rt;
+        }
+        fd_ctx->rings |= 1ull << (index % 64);
+    }
+
+    // Fiber::cancel() -> cancel the operation on our ring by its user_data, the completion still resumes us
+    Fiber* fiber = req->fiber.get();
+    Uring* ring = m_wakers[index]->ring.get();
+    UringRequest* request = req.get();
+    auto on_cancel = [request, ring]() 
+    {
+        request->cancelled = true;
+        io_uring_sqe cancel;
+        memset(&cancel, 0, sizeof(cancel));
+        cancel.opcode = IORING_OP_ASYNC_CANCEL;
+        cancel.fd     = -1;
+        cancel.addr   = (uint64_t)request;
+        ring->submit(cancel);
+    };
+    if (!fiber->setCancelHook(on_cancel)) 
+    {
+        on_cancel();
+    }
+
+    // resumed by reapIo()
+    fiber->yield();
+    fiber->clearCancelHook();
+
+    if (req->res != -ECANCELED) 
+    {
+        return req->res;
+    }
+    // canceled by Fiber::cancel(), the linked timeout or cancelAll()
+    if (req->cancelled) 
+    {
+        return -ECANCELED;
+    }
+    if (timeout_ms != ~0ull && std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(timeout_ms)) 
+    {
+        return -ETIMEDOUT;
+    }
+    return -EBADF;
+}
+
+void IOManager::reapIo(Uring &ring) 
+{
+    static const size_t MAX_CQES = 64;
+    io_uring_cqe cqes[MAX_CQES];
+    size_t n = 0;
+    while ((n = ring.reap(cqes, MAX_CQES)) > 0) 
+    {
+        for (size_t i = 0; i < n; ++i) 
+        {
+            // linked timeouts and cancel requests
+            if (!cqes[i].user_data) 
+            {
+                continue;
+            }
+            // don't touch req after scheduling -> it's freed once the fiber resumes
+            UringRequest *req = (UringRequest *)cqes[i].user_data;
+            req->res = cqes[i].res;
+            scheduleLock(&req->fiber);
+            --m_pendingEventCount;
+        }
+    }
+    ring.flush();
+}
+
+void IOManager::cancelIo(FdContext *fd_ctx) 
+{
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode       = IORING_OP_ASYNC_CANCEL;
+    sqe.fd           = fd_ctx->fd;
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+
+    for (size_t i = 0; i < m_wakers.size(); ++i) 
+    {
+        if (fd_ctx->rings & (1ull << (i % 64))) 
+        {
+            m_wakers[i]->ring->submit(sqe);
+        }
+    }
+    fd_ctx->rings = 0;
+}
+
+int IOManager::getEpfd(FdContext *fd_ctx) 
+{
+    if (isSharded() && fd_ctx->owner != -1) 
+    {
+        return m_wakers[fd_ctx->owner]->epfd;
+    }
+    return m_epfd;
+}
+
+int IOManager::getOwnerThread(FdContext *fd_ctx) 
+{
+    if (isSharded() && fd_ctx->owner != -1) 
+    {
+        return getWorkerThreadId(fd_ctx->owner);
+    }
+    return -1;
+}
+
+bool IOManager::wakeWorker(int index) 
+{
+    Waker& waker = *m_wakers[index];
+    int state = waker.state;
+    // only the one who moves it out of PARKED/POLLING writes -> one wakeup per idle period
+    if (state == RUNNING || !waker.state.compare_exchange_strong(state, RUNNING)) 
+    {
+        return false;
+    }
+
+    onWakeupSent(index);
+    uint64_t one = 1;
+    // the poller of a shard waits on its own epoll -> which holds its own eventfd
+    int fd = state == POLLING && m_reactor == EPOLL ? m_pollerFd : waker.fd;
+    int rt = write(fd, &one, sizeof(one));
+    assert(rt == sizeof(one));
+    return true;
+}
+
+bool IOManager::wakeParked() 
+{
+    size_t n = m_wakers.size();
+    size_t start = m_nextWake++;
+    for (size_t i = 0; i < n; ++i) 
+    {
+        int index = (start + i) % n;
+        if (m_wakers[index]->state == PARKED && wakeWorker(index)) 
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 void IOManager::tickle() 
 {
-    // no idle threads
-    if(!hasIdleThreads()) 
+    // pairs with the fence in idle() -> either we see the worker idle or it sees the new task
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // prefer a parked worker -> the poller keeps watching m_epfd
+    if (wakeParked()) 
     {
         return;
     }
-    int rt = write(m_tickleFds[1], "T", 1);
-    assert(rt == 1);
+    int poller = m_poller;
+    if (poller != -1) 
+    {
+        wakeWorker(poller);
+    }
+}
+
+void IOManager::tickleWorker(int index) 
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wakeWorker(index);
 }
 
 bool IOManager::stopping() 
 {
-    uint64_t timeout = getNextTimer();
     // no timers left and no pending events left with the Scheduler::stopping()
-    return timeout == ~0ull && m_pendingEventCount == 0 && Scheduler::stopping();
+    return !hasTimer() && m_pendingEventCount == 0 && Scheduler::stopping();
 }
 
 
@@ -351,37 +698,90 @@ void IOManager::idle()
     static const uint64_t MAX_EVNETS = 256;
     std::unique_ptr<epoll_event[]> events(new epoll_event[MAX_EVNETS]);
 
+    int index = getWorkerIndex();
+    Waker& self = *m_wakers[index];
+    t_timer_owner = this;
+
     while (true) 
     {
         if(debug) std::cout << "IOManager::idle(),run in thread: " << Thread::GetThreadId() << std::endl; 
 
         if(stopping()) 
         {
+            t_timer_owner = nullptr;
+            // parked workers can't see it by themselves -> pairs with the fence after publishing the state
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (size_t i = 0; i < m_wakers.size(); ++i) 
+            {
+                if ((int)i != index) 
+                {
+                    wakeWorker(i);
+                }
+            }
             if(debug) std::cout << "name = " << getName() << " idle exits in thread: " << Thread::GetThreadId() << std::endl;
             break;
         }
 
-        // blocked at epoll_wait
+        // the poller watches m_epfd -> the others park, every worker sleeps until its own earliest timer
+        int expected = -1;
+        bool poller = m_poller.compare_exchange_strong(expected, index);
+        int state = poller ? POLLING : PARKED;
+        self.state = state;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        // check again after publishing the state -> a task, the poller leaving or the last worker stopping may have raced with us
+        bool leaving = (hasPendingTasks(index) || (!poller && m_poller == -1) || stopping()) && self.state.compare_exchange_strong(state, RUNNING);
+
+        static const uint64_t MAX_TIMEOUT_US = 5000 * 1000;
         int rt = 0;
-        while(true)
+        if (!leaving && !poller && m_reactor == EPOLL) 
         {
-            static const uint64_t MAX_TIMEOUT = 5000;
-            uint64_t next_timeout = getNextTimer();
-            next_timeout = std::min(next_timeout, MAX_TIMEOUT);
-
-            rt = epoll_wait(m_epfd, events.get(), MAX_EVNETS, (int)next_timeout);
-            // EINTR -> retry
-            if(rt < 0 && errno == EINTR) 
+            // park on our own eventfd -> EINTR just returns early
+            park_us(self.fd, std::min(getNextTimerUs(), MAX_TIMEOUT_US));
+        }
+        else if (!leaving)
+        {
+            // blocked at epoll_wait -> the shared epoll, or our own shard which also holds our eventfd
+            int epfd = isSharded() ? self.epfd : m_epfd;
+            while(true)
             {
-                continue;
-            } 
-            else 
+                uint64_t next_timeout = std::min(getNextTimerUs(), MAX_TIMEOUT_US);
+
+                rt = epoll_wait_us(epfd, events.get(), MAX_EVNETS, next_timeout);
+                // EINTR -> retry
+                if(rt < 0 && errno == EINTR) 
+                {
+                    continue;
+                } 
+                else 
+                {
+                    break;
+                }
+            };
+        }
+
+        self.state = RUNNING;
+        uint64_t sent = 0;
+        if (poller) 
+        {
+            // drain our wakeup while still the poller -> draining it later could eat one meant for the next poller
+            for (int i = 0; i < rt; ++i) 
             {
-                break;
+                if (events[i].data.fd == m_pollerFd) 
+                {
+                    uint64_t dummy;
+                    // edge triggered -> reset the counter
+                    while (read(m_pollerFd, &dummy, sizeof(dummy)) > 0);
+                }
             }
-        };
+            // give up polling before scheduling anything -> whoever ends up idle polls next
+            m_poller = -1;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            sent = getWakeupStats().sent;
+            leaving = leaving || rt > 0;
+        }
 
-        // collect all timers overdue
+        // collect the timers overdue in our own shard
         std::vector<std::function<void()>> cbs;
         listExpiredCb(cbs);
         if(!cbs.empty()) 
@@ -391,6 +791,7 @@ void IOManager::idle()
                 scheduleLock(cb);
             }
             cbs.clear();
+            leaving = true;
         }
         
         // collect all events ready
@@ -398,12 +799,22 @@ void IOManager::idle()
         {
             epoll_event& event = events[i];
 
-            // tickle event
-            if (event.data.fd == m_tickleFds[0]) 
+            // tickle event -> already drained above
+            if (event.data.fd == m_pollerFd) 
+            {
+                continue;
+            }
+            if (self.ring && event.data.fd == self.ring->getFd()) 
+            {
+                reapIo(*self.ring);
+                continue;
+            }
+            if (event.data.fd == self.fd) 
             {
-                uint8_t dummy[256];
-                // edge triggered -> exhaust
-                while (read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
+                // a single read resets the counter
+                uint64_t dummy;
+                int rt3 = read(self.fd, &dummy, sizeof(dummy));
+                (void)rt3;
                 continue;
             }
 
@@ -411,10 +822,16 @@ void IOManager::idle()
             FdContext *fd_ctx = (FdContext *)event.data.ptr;
             std::lock_guard<std::mutex> lock(fd_ctx->mutex);
 
+            // moved to another shard by rebindFd() after this event was reported
+            if (isSharded() && fd_ctx->owner != index) 
+            {
+                continue;
+            }
+
             // convert EPOLLERR or EPOLLHUP to -> read or write event
             if (event.events & (EPOLLERR | EPOLLHUP)) 
             {
-                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+                event.events |= (EPOLLIN | EPOLLOUT) & (fd_ctx->registered ? (READ | WRITE) : fd_ctx->events);
             }
             // events happening during this turn of epoll_wait
             int real_events = NONE;
@@ -427,44 +844,67 @@ void IOManager::idle()
                 real_events |= WRITE;
             }
 
+            // persistent -> remember the edges nobody is waiting for, the next addEvent consumes them
+            if (fd_ctx->registered) 
+            {
+                fd_ctx->ready |= real_events & ~fd_ctx->events;
+                real_events &= fd_ctx->events;
+            }
+
             if ((fd_ctx->events & real_events) == NONE) 
             {
                 continue;
             }
 
             // delete the events that have already happened
-            int left_events = (fd_ctx->events & ~real_events);
-            int op          = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events    = EPOLLET | left_events;
-
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if (rt2) 
+            if (!fd_ctx->registered) 
             {
-                std::cerr << "idle::epoll_ctl failed: " << strerror(errno) << std::endl; 
-                continue;
+                int left_events = (fd_ctx->events & ~real_events);
+                int op          = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+                event.events    = EPOLLET | left_events;
+
+                int rt2 = epoll_ctl(getEpfd(fd_ctx), op, fd_ctx->fd, &event);
+                if (rt2) 
+                {
+                    std::cerr << "idle::epoll_ctl failed: " << strerror(errno) << std::endl; 
+                    continue;
+                }
             }
 
             // schedule callback and update fdcontext and event context
             if (real_events & READ) 
             {
-                fd_ctx->triggerEvent(READ);
+                fd_ctx->triggerEvent(READ, getOwnerThread(fd_ctx));
                 --m_pendingEventCount;
             }
             if (real_events & WRITE) 
             {
-                fd_ctx->triggerEvent(WRITE);
+                fd_ctx->triggerEvent(WRITE, getOwnerThread(fd_ctx));
                 --m_pendingEventCount;
             }
         } // end for
 
+        // going to run tasks and nobody was woken up meanwhile -> hand the poller role to a parked worker
+        if (poller && leaving && getWakeupStats().sent == sent) 
+        {
+            wakeParked();
+        }
+
         Fiber::GetThis()->yield();
   
     } // end while(true)
 }
 
-void IOManager::onTimerInsertedAtFront() 
+void IOManager::onTimerInsertedAtFront(int shard) 
+{
+    // the owner of the shard has to recompute its timeout -> a running owner does it before sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    wakeWorker(shard);
+}
+
+int IOManager::getTimerShard() 
 {
-    tickle();
+    return t_timer_owner == this ? getWorkerIndex() : -1;
 }
 
 } // end namespace sylar
\ No newline at end of file
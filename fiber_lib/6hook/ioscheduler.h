@@ -3,6 +3,8 @@
 
 #include "scheduler.h"
 #include "timer.h"
+#include "uring.h"
+#include "chunked_table.h"
 
 namespace sylar {
 
@@ -20,8 +22,21 @@ public:
         WRITE = 0x4
     };
 
+    enum Reactor 
+    {
+        // one epoll shared by all workers
+        EPOLL,
+        // one epoll per worker -> an fd is bound to the worker that registers it first
+        // and its callbacks run on that worker; an fd owned by a busy worker waits until it goes idle
+        SHARDED_EPOLL,
+        // SHARDED_EPOLL + one io_uring per worker -> hooked socket io is submitted to the ring
+        // falls back to EPOLL when io_uring is not available
+        IO_URING
+    };
+
 private:
-    struct FdContext 
+    // one cache line per fd at least -> workers handling neighbouring fds don't share lines
+    struct alignas(64) FdContext 
     {
         struct EventContext 
         {
@@ -40,15 +55,24 @@ private:
         int fd = 0;
         // events registered
         Event events = NONE;
+        // worker whose epoll holds this fd (SHARDED_EPOLL) -> -1 unbound
+        int owner = -1;
+        // workers whose ring may have operations on this fd, bit (index % 64) (IO_URING)
+        uint64_t rings = 0;
+        // persistent mode -> the fd stays in epoll with EPOLLIN | EPOLLOUT | EPOLLET until close()
+        bool registered = false;
+        // persistent mode -> edges that fired while nobody was waiting
+        int ready = NONE;
         std::mutex mutex;
 
         EventContext& getEventContext(Event event);
         void resetEventContext(EventContext &ctx);
-        void triggerEvent(Event event);        
+        // thread != -1 -> run the callback on that thread
+        void triggerEvent(Event event, int thread = -1);        
     };
 
 public:
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager");
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string &name = "IOManager", QueueMode mode = SHARED_QUEUE, Reactor reactor = EPOLL);
     ~IOManager();
 
     // add one event at a time
@@ -59,28 +83,114 @@ public:
     bool cancelEvent(int fd, Event event);
     // delete all events and trigger its callback
     bool cancelAll(int fd);
+    // a new fd took this number -> forget what was latched for the old one
+    // needed when the old fd was closed without the hooked close() (fclose, another thread), the hooks call it on socket()/accept()
+    void resetFd(int fd);
+
+    // register each fd once for both directions and latch readiness in user space
+    // -> no epoll_ctl per wait, close() removes the registration; set before any fd is registered
+    // an fd closed without the hooked close() keeps its registration flag -> resetFd() before its number is used again
+    void setPersistentEvents(bool v) { m_persistent = v; }
+    bool isPersistentEvents() const { return m_persistent; }
+
+    // SHARDED_EPOLL -> move fd to the epoll of worker index, for rebalancing
+    bool rebindFd(int fd, int index);
+
+    // the reactor in use -> IO_URING may have fallen back to EPOLL
+    Reactor getReactor() const { return m_reactor; }
+
+    // IO_URING -> submit sqe to this worker's ring and suspend the current fiber until it completes
+    // returns the completion result (-errno on error), -ETIMEDOUT after timeout_ms, -EBADF when close() canceled it,
+    // -ECANCELED when the fiber was canceled, -ENOTSUP when the calling thread has no ring,
+    // -EBUSY when the submission queue is full (nothing was submitted)
+    int submitIo(io_uring_sqe &sqe, uint64_t timeout_ms = ~0ull);
 
     static IOManager* GetThis();
 
 protected:
+    // wake exactly one idle worker
     void tickle() override;
+    // wake the given worker if it is idle
+    void tickleWorker(int index) override;
     
     bool stopping() override;
     
     void idle() override;
 
-    void onTimerInsertedAtFront() override;
+    // wake the worker owning the timer shard
+    void onTimerInsertedAtFront(int shard) override;
+    // the worker's own shard while it is idle -> timers from elsewhere are handed over lock-free
+    int getTimerShard() override;
+
+private:
+    // idle worker states
+    enum WakerState
+    {
+        // running tasks -> no wakeup needed
+        RUNNING,
+        // blocked on its own eventfd
+        PARKED,
+        // blocked in epoll_wait on m_epfd
+        POLLING
+    };
+
+    struct Waker
+    {
+        // per-worker eventfd for parked workers
+        int fd = -1;
+        // the worker's own epoll (SHARDED_EPOLL)
+        int epfd = -1;
+        // the worker's own ring (IO_URING)
+        std::unique_ptr<Uring> ring;
+        std::atomic<int> state = {RUNNING};
+    };
+
+    // an io_uring operation waiting for its completion
+    // the kernel and reapIo() use it while the fiber is parked -> never on a shared stack (OffStack)
+    struct UringRequest
+    {
+        std::shared_ptr<Fiber> fiber;
+        int res = 0;
+        // set by Fiber::cancel()
+        bool cancelled = false;
+        // the linked timeout -> read by the kernel when the sqes are submitted, maybe by a later flush()
+        __kernel_timespec ts;
+    };
+
+    static const unsigned URING_ENTRIES = 256;
+
+    bool isSharded() const { return m_reactor != EPOLL; }
+    // resume the fibers of completed operations
+    void reapIo(Uring &ring);
+    // cancel the ring operations on fd_ctx
+    void cancelIo(FdContext *fd_ctx);
+
+    // the epoll holding fd_ctx
+    int getEpfd(FdContext *fd_ctx);
+    // the thread that callbacks of fd_ctx run on -> -1 any
+    int getOwnerThread(FdContext *fd_ctx);
 
-    void contextResize(size_t size);
+    // wake index if it is parked or polling -> false if it's running or someone else woke it
+    bool wakeWorker(int index);
+    // wake one parked worker
+    bool wakeParked();
 
 private:
     int m_epfd = 0;
-    // fd[0] read，fd[1] write
-    int m_tickleFds[2];
+    // eventfd registered in m_epfd -> wakes the polling worker
+    int m_pollerFd = -1;
+    // at most one idle worker polls m_epfd and runs the timers, the others park
+    std::atomic<int> m_poller = {-1};
+    std::vector<std::unique_ptr<Waker>> m_wakers;
+    // round-robin start for tickle()
+    std::atomic<size_t> m_nextWake = {0};
+    Reactor m_reactor;
+    bool m_persistent = false;
+    // round-robin shard for fds registered from outside the workers
+    std::atomic<size_t> m_nextShard = {0};
     std::atomic<size_t> m_pendingEventCount = {0};
-    std::shared_mutex m_mutex;
-    // store fdcontexts for each fd
-    std::vector<FdContext *> m_fdContexts;
+    // store fdcontexts for each fd -> never move, lookups take no lock
+    ChunkedTable<FdContext> m_fdContexts;
 };
 
 } // end namespace sylar
@@ -0,0 +1,183 @@
+#ifndef _MPMC_QUEUE_H_
+#define _MPMC_QUEUE_H_
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace sylar {
+
+// 有界无锁多生产者多消费者队列 (Dmitry Vyukov)
+// 每个槽位带一个序号 -> 生产者/消费者通过CAS竞争位置 -> 序号表明槽位是否可写/可读
+template <class T>
+class MPMCQueue
+{
+public:
+	// 容量向上取整为2的幂
+	explicit MPMCQueue(size_t capacity = 4096)
+	{
+		size_t size = 2;
+		while(size < capacity)
+		{
+			size <<= 1;
+		}
+		m_mask = size - 1;
+		m_cells.reset(new Cell[size]);
+		for(size_t i=0;i<size;i++)
+		{
+			m_cells[i].seq.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	MPMCQueue(const MPMCQueue&) = delete;
+	MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+	// 队列已满返回false
+	bool tryPush(T&& value)
+	{
+		Cell* cell;
+		size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+		while(true)
+		{
+			cell = &m_cells[pos & m_mask];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if(diff == 0)
+			{
+				if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if(diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = m_enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		cell->data = std::move(value);
+		cell->seq.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	// 队列为空返回false
+	bool tryPop(T& value)
+	{
+		Cell* cell;
+		size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+		while(true)
+		{
+			cell = &m_cells[pos & m_mask];
+			size_t seq = cell->seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+			if(diff == 0)
+			{
+				if(m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if(diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				pos = m_dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+		value = std::move(cell->data);
+		// 释放槽位中的资源
+		cell->data = T();
+		cell->seq.store(pos + m_mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	// 并发时只是近似值
+	size_t size() const
+	{
+		size_t enqueue = m_enqueuePos.load(std::memory_order_relaxed);
+		size_t dequeue = m_dequeuePos.load(std::memory_order_relaxed);
+		return enqueue > dequeue ? enqueue - dequeue : 0;
+	}
+
+	bool empty() const {return size() == 0;}
+
+	size_t capacity() const {return m_mask + 1;}
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> seq;
+		T data;
+	};
+
+private:
+	std::unique_ptr<Cell[]> m_cells;
+	size_t m_mask = 0;
+	// 生产者和消费者的位置放在不同的缓存行 -> 避免伪共享
+	alignas(64) std::atomic<size_t> m_enqueuePos = {0};
+	alignas(64) std::atomic<size_t> m_dequeuePos = {0};
+};
+
+// 无界队列 -> 有界无锁队列 + 满时使用的加锁溢出队列
+// 正常负载下只走无锁路径 突发超出容量时退化为加锁 -> 不保证严格FIFO
+template <class T>
+class UnboundedMPMCQueue
+{
+public:
+	explicit UnboundedMPMCQueue(size_t capacity = 4096): m_queue(capacity) {}
+
+	void push(T&& value)
+	{
+		if(m_overflowSize.load(std::memory_order_relaxed) == 0 && m_queue.tryPush(std::move(value)))
+		{
+			return;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_overflow.push_back(std::move(value));
+		m_overflowSize.fetch_add(1, std::memory_order_release);
+	}
+
+	bool tryPop(T& value)
+	{
+		if(m_queue.tryPop(value))
+		{
+			return true;
+		}
+		if(m_overflowSize.load(std::memory_order_acquire) == 0)
+		{
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_overflow.empty())
+		{
+			return false;
+		}
+		value = std::move(m_overflow.front());
+		m_overflow.pop_front();
+		m_overflowSize.fetch_sub(1, std::memory_order_release);
+		return true;
+	}
+
+	size_t size() const {return m_queue.size() + m_overflowSize.load(std::memory_order_relaxed);}
+
+	bool empty() const {return size() == 0;}
+
+private:
+	MPMCQueue<T> m_queue;
+	std::mutex m_mutex;
+	std::deque<T> m_overflow;
+	std::atomic<size_t> m_overflowSize = {0};
+};
+
+}
+
+#endif
@@ -1,10 +1,16 @@
 #include "scheduler.h"
+#include "stack_allocator.h"
 
 static bool debug = false;
 
 namespace sylar {
 
 static thread_local Scheduler* t_scheduler = nullptr;
+// 当前线程在调度器中的编号
+static thread_local int t_worker_index = -1;
+
+// 从全局注入队列/其他线程一次最多取出的任务数
+static const size_t MAX_BATCH = 32;
 
 Scheduler* Scheduler::GetThis()
 {
@@ -16,20 +22,28 @@ void Scheduler::SetThis()
 	t_scheduler = this;
 }
 
-Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name):
-m_useCaller(use_caller), m_name(name)
+Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name, QueueMode mode):
+m_useCaller(use_caller), m_name(name), m_mode(mode)
 {
 	assert(threads>0 && Scheduler::GetThis()==nullptr);
 
-	SetThis();
-
 	Thread::SetName(m_name);
 
+	m_workers.resize(threads);
+	for(size_t i=0;i<threads;i++)
+	{
+		m_workers[i].reset(new Worker());
+	}
+	t_worker_index = -1;
+
 	// 使用主线程当作工作线程
 	if(use_caller)
 	{
 		threads --;
 
+		// 主线程不参与调度时不设置 -> 主线程提交的任务属于外部提交
+		SetThis();
+
 		// 创建主协程
 		Fiber::GetThis();
 
@@ -39,6 +53,10 @@ m_useCaller(use_caller), m_name(name)
 		
 		m_rootThread = Thread::GetThreadId();
 		m_threadIds.push_back(m_rootThread);
+
+		// 主线程编号为0
+		t_worker_index = 0;
+		m_workers[0]->threadId = m_rootThread;
 	}
 
 	m_threadCount = threads;
@@ -66,10 +84,17 @@ void Scheduler::start()
 
 	assert(m_threads.empty());
 	m_threads.resize(m_threadCount);
+	int offset = m_useCaller ? 1 : 0;
 	for(size_t i=0;i<m_threadCount;i++)
 	{
-		m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
+		int index = i + offset;
+		m_threads[i].reset(new Thread([this, index]()
+		{
+			t_worker_index = index;
+			run();
+		}, m_name + "_" + std::to_string(i)));
 		m_threadIds.push_back(m_threads[i]->getId());
+		m_workers[index]->threadId = m_threads[i]->getId();
 	}
 	if(debug) std::cout << "Scheduler::start() success\n";
 }
@@ -89,7 +114,11 @@ void Scheduler::run()
 		Fiber::GetThis();
 	}
 
+	int index = getWorkerIndex();
+
 	std::shared_ptr<Fiber> idle_fiber = std::make_shared<Fiber>(std::bind(&Scheduler::idle, this));
+	// 上一个回调任务结束后留下的协程 -> 下一个回调任务复用
+	std::shared_ptr<Fiber> cb_fiber;
 	ScheduleTask task;
 	
 	while(true)
@@ -97,27 +126,40 @@ void Scheduler::run()
 		task.reset();
 		bool tickle_me = false;
 
+		// 先取指定在本线程运行的任务
+		if(dequeueMailbox(task, index))
+		{
+		}
+		else if(m_mode == WORK_STEALING)
+		{
+			tickle_me = dequeueStealing(task, index);
+		}
+		else if(m_mode == LOCKFREE_QUEUE)
 		{
+			// 先增加活跃线程数再出队 -> stopping()不会误判
+			m_activeThreadCount++;
+			if(m_lockfreeTasks.tryPop(task))
+			{
+				tickle_me = !m_lockfreeTasks.empty();
+			}
+			else
+			{
+				m_activeThreadCount--;
+			}
+		}
+		else
+		{
+			// 1 任务队列中只有未指定线程的任务 -> 直接取队头
 			std::lock_guard<std::mutex> lock(m_mutex);
-			auto it = m_tasks.begin();
-			// 1 遍历任务队列
-			while(it!=m_tasks.end())
+			if(!m_tasks.empty())
 			{
-				if(it->thread!=-1&&it->thread!=thread_id)
-				{
-					it++;
-					tickle_me = true;
-					continue;
-				}
-
 				// 2 取出任务
-				assert(it->fiber||it->cb);
-				task = *it;
-				m_tasks.erase(it); 
+				task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+				assert(task.fiber||task.cb);
 				m_activeThreadCount++;
-				break;
-			}	
-			tickle_me = tickle_me || (it != m_tasks.end());
+			}
+			tickle_me = !m_tasks.empty();
 		}
 
 		if(tickle_me)
@@ -125,6 +167,11 @@ void Scheduler::run()
 			tickle();
 		}
 
+		if((task.fiber || task.cb) && m_workers[index]->woken.exchange(false))
+		{
+			m_wakeupsUseful++;
+		}
+
 		// 3 执行任务
 		if(task.fiber)
 		{
@@ -140,13 +187,27 @@ void Scheduler::run()
 		}
 		else if(task.cb)
 		{
-			std::shared_ptr<Fiber> cb_fiber = std::make_shared<Fiber>(task.cb);
+			if(cb_fiber)
+			{
+				cb_fiber->reset(std::move(task.cb));
+			}
+			else
+			{
+				// 协程栈来自StackAllocator的线程本地缓存
+				cb_fiber = std::make_shared<Fiber>(std::move(task.cb));
+			}
 			{
 				std::lock_guard<std::mutex> lock(cb_fiber->m_mutex);
 				cb_fiber->resume();			
 			}
 			m_activeThreadCount--;
 			task.reset();	
+
+			// 未结束(挂起等待事件) 或 仍被其他地方引用 -> 不能复用
+			if(!m_recycleFibers || cb_fiber->getState() != Fiber::TERM || cb_fiber.use_count() > 1)
+			{
+				cb_fiber.reset();
+			}
 		}
 		// 4 无任务 -> 执行空闲协程
 		else
@@ -157,6 +218,8 @@ void Scheduler::run()
             	if(debug) std::cout << "Schedule::run() ends in thread: " << thread_id << std::endl;
                 break;
             }
+			// 被唤醒但没有取到任务
+			m_workers[index]->woken = false;
 			m_idleThreadCount++;
 			idle_fiber->resume();				
 			m_idleThreadCount--;
@@ -211,13 +274,27 @@ void Scheduler::stop()
 	{
 		i->join();
 	}
-	if(debug) std::cout << "Schedule::stop() ends in thread:" << Thread::GetThreadId() << std::endl;
+	if(debug) 
+	{
+		StackAllocator::Stats stats = StackAllocator::GetStats();
+		std::cout << "stack allocator: hits = " << stats.hits << ", misses = " << stats.misses 
+			<< ", resident = " << stats.resident_bytes << ", cached = " << stats.cached_bytes << std::endl;
+		WakeupStats wakeups = getWakeupStats();
+		std::cout << "wakeups: sent = " << wakeups.sent << ", useful = " << wakeups.useful << std::endl;
+		std::cout << "Schedule::stop() ends in thread:" << Thread::GetThreadId() << std::endl;
+	}
 }
 
 void Scheduler::tickle()
 {
 }
 
+// 基类没有单个线程的唤醒手段 -> 与tickle()一样
+void Scheduler::tickleWorker(int /*index*/)
+{
+	tickle();
+}
+
 void Scheduler::idle()
 {
 	while(!stopping())
@@ -231,7 +308,303 @@ void Scheduler::idle()
 bool Scheduler::stopping() 
 {
     std::lock_guard<std::mutex> lock(m_mutex);
-    return m_stopping && m_tasks.empty() && m_activeThreadCount == 0;
+    return m_stopping && m_tasks.empty() && m_lockfreeTasks.empty() && m_localTaskCount == 0 && m_activeThreadCount == 0;
+}
+
+int Scheduler::getWorkerIndex() const
+{
+	return GetThis() == this ? t_worker_index : -1;
+}
+
+int Scheduler::findWorker(int thread)
+{
+	for(size_t i=0;i<m_workers.size();i++)
+	{
+		if(m_workers[i]->threadId == thread)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+bool Scheduler::scheduleMailbox(ScheduleTask& task)
+{
+	int target = findWorker(task.thread);
+	if(target == -1)
+	{
+		// 不是该调度器的线程 -> 不指定
+		task.thread = -1;
+		return false;
+	}
+
+	Worker& worker = *m_workers[target];
+	{
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		m_localTaskCount++;
+		worker.mailbox.push_back(std::move(task));
+		worker.mailboxSize++;
+	}
+	// 目标是当前线程 -> 当前任务结束后就会取到
+	if(target != getWorkerIndex())
+	{
+		tickleWorker(target);
+	}
+	return true;
+}
+
+bool Scheduler::dequeueMailbox(ScheduleTask& task, int index)
+{
+	Worker& self = *m_workers[index];
+	if(self.mailboxSize == 0)
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(self.mutex);
+	if(self.mailbox.empty())
+	{
+		return false;
+	}
+	task = std::move(self.mailbox.front());
+	self.mailbox.pop_front();
+	self.mailboxSize--;
+	// 先增加活跃线程数再减少任务数 -> stopping()不会误判
+	m_activeThreadCount++;
+	m_localTaskCount--;
+	return true;
+}
+
+bool Scheduler::hasPendingTasks(int index)
+{
+	if(index != -1 && m_workers[index]->mailboxSize > 0)
+	{
+		return true;
+	}
+	if(!m_lockfreeTasks.empty())
+	{
+		return true;
+	}
+	if(m_mode == WORK_STEALING)
+	{
+		// 其他线程mailbox中的任务取不到 -> 只算可以窃取的任务
+		size_t mailbox = 0;
+		for(auto& worker : m_workers)
+		{
+			mailbox += worker->mailboxSize;
+		}
+		return m_localTaskCount > mailbox;
+	}
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return !m_tasks.empty();
+}
+
+void Scheduler::onWakeupSent(int index)
+{
+	m_wakeupsSent++;
+	m_workers[index]->woken = true;
+}
+
+Scheduler::WakeupStats Scheduler::getWakeupStats() const
+{
+	WakeupStats stats;
+	stats.sent = m_wakeupsSent;
+	stats.useful = m_wakeupsUseful;
+	return stats;
+}
+
+void Scheduler::scheduleStealing(ScheduleTask& task)
+{
+	// 1 调度器内部提交 -> 放入本线程的本地队列
+	int index = getWorkerIndex();
+	if(index != -1)
+	{
+		Worker& worker = *m_workers[index];
+		{
+			std::lock_guard<std::mutex> lock(worker.mutex);
+			m_localTaskCount++;
+			worker.tasks.push_back(std::move(task));
+		}
+		// 唤醒空闲线程来窃取
+		tickle();
+		return;
+	}
+
+	// 2 外部提交 -> 放入全局注入队列
+	m_lockfreeTasks.push(std::move(task));
+	tickle();
+}
+
+void Scheduler::scheduleBatch(std::shared_ptr<Fiber>* fibers, size_t n)
+{
+	bool need_tickle = false;
+	std::unique_lock<std::mutex> lock;
+	int index = getWorkerIndex();
+	if(m_mode == SHARED_QUEUE)
+	{
+		lock = std::unique_lock<std::mutex>(m_mutex);
+		need_tickle = m_tasks.empty();
+	}
+	else if(m_mode == WORK_STEALING && index != -1)
+	{
+		lock = std::unique_lock<std::mutex>(m_workers[index]->mutex);
+		need_tickle = true;
+	}
+	else
+	{
+		need_tickle = m_lockfreeTasks.empty();
+	}
+
+	for(size_t i=0;i<n;i++)
+	{
+		ScheduleTask task(&fibers[i], -1);
+		if(!task.fiber)
+		{
+			continue;
+		}
+		// 共享栈协程只能在绑定的线程上恢复 -> 放入mailbox 不在这里加锁
+		if(task.thread != -1)
+		{
+			fibers[i].swap(task.fiber);
+			continue;
+		}
+		if(m_mode == SHARED_QUEUE)
+		{
+			m_tasks.push_back(std::move(task));
+		}
+		else if(lock.owns_lock())
+		{
+			m_localTaskCount++;
+			m_workers[index]->tasks.push_back(std::move(task));
+		}
+		else
+		{
+			m_lockfreeTasks.push(std::move(task));
+		}
+	}
+	if(lock.owns_lock())
+	{
+		lock.unlock();
+	}
+	if(need_tickle)
+	{
+		tickle();
+	}
+
+	// 绑定线程的协程 -> 逐个放入mailbox
+	for(size_t i=0;i<n;i++)
+	{
+		if(fibers[i])
+		{
+			scheduleLock(&fibers[i]);
+		}
+	}
+}
+
+// 返回值: 是否还有剩余任务需要唤醒其他线程
+bool Scheduler::dequeueStealing(ScheduleTask& task, int index)
+{
+	Worker& self = *m_workers[index];
+
+	// 1 本地队列
+	{
+		std::lock_guard<std::mutex> lock(self.mutex);
+		if(!self.tasks.empty())
+		{
+			task = std::move(self.tasks.front());
+			self.tasks.pop_front();
+			// 先增加活跃线程数再减少任务数 -> stopping()不会误判
+			m_activeThreadCount++;
+			m_localTaskCount--;
+			return !self.tasks.empty();
+		}
+	}
+
+	// 2 全局注入队列 -> 按线程数平分 多取的放入本地队列
+	std::vector<ScheduleTask> batch;
+	bool more = false;
+	m_activeThreadCount++;
+	if(m_lockfreeTasks.tryPop(task))
+	{
+		size_t n = std::min(m_lockfreeTasks.size() / m_workers.size() + 1, MAX_BATCH);
+		for(size_t i=1;i<n;i++)
+		{
+			ScheduleTask t;
+			m_localTaskCount++;
+			if(!m_lockfreeTasks.tryPop(t))
+			{
+				m_localTaskCount--;
+				break;
+			}
+			batch.push_back(std::move(t));
+		}
+		more = !m_lockfreeTasks.empty();
+	}
+	else
+	{
+		m_activeThreadCount--;
+	}
+	if(task.fiber || task.cb)
+	{
+		if(!batch.empty())
+		{
+			std::lock_guard<std::mutex> lock(self.mutex);
+			for(auto& t : batch)
+			{
+				self.tasks.push_back(std::move(t));
+			}
+			more = true;
+		}
+		return more;
+	}
+
+	// 3 从其他线程窃取
+	for(size_t i=1;i<m_workers.size();i++)
+	{
+		int victim = (index + i) % m_workers.size();
+		if(steal(task, index, victim))
+		{
+			std::lock_guard<std::mutex> lock(self.mutex);
+			return !self.tasks.empty();
+		}
+	}
+	return false;
+}
+
+bool Scheduler::steal(ScheduleTask& task, int index, int victim)
+{
+	// 尾部是最新提交的任务
+	std::vector<ScheduleTask> stolen;
+	{
+		Worker& worker = *m_workers[victim];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if(worker.tasks.empty())
+		{
+			return false;
+		}
+		size_t n = std::min((worker.tasks.size() + 1) / 2, MAX_BATCH);
+		for(size_t i=0;i<n;i++)
+		{
+			stolen.push_back(std::move(worker.tasks.back()));
+			worker.tasks.pop_back();
+		}
+		m_activeThreadCount++;
+		m_localTaskCount--;
+	}
+
+	// 执行其中最早提交的一个 其余按原顺序放入本地队列
+	task = std::move(stolen.back());
+	stolen.pop_back();
+	if(!stolen.empty())
+	{
+		Worker& self = *m_workers[index];
+		std::lock_guard<std::mutex> lock(self.mutex);
+		for(auto it = stolen.rbegin(); it != stolen.rend(); ++it)
+		{
+			self.tasks.push_back(std::move(*it));
+		}
+	}
+	return true;
 }
 
 
@@ -4,20 +4,48 @@
 #include "hook.h"
 #include "fiber.h"
 #include "thread.h"
+#include "mpmc_queue.h"
 
 #include <mutex>
 #include <vector>
+#include <deque>
 
 namespace sylar {
 
 class Scheduler
 {
 public:
-	Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name="Scheduler");
+	// 任务队列模式 -> 指定线程的任务在所有模式下都放入该线程的mailbox
+	enum QueueMode
+	{
+		// 所有线程共享一个任务队列
+		SHARED_QUEUE,
+		// 所有线程共享一个无锁任务队列
+		LOCKFREE_QUEUE,
+		// 每个线程一个本地队列 + 外部提交的全局注入队列 + 空闲时从其他线程窃取
+		WORK_STEALING
+	};
+
+	// 唤醒统计
+	struct WakeupStats
+	{
+		// 发出的唤醒次数
+		uint64_t sent = 0;
+		// 被唤醒的线程随后取到了任务
+		uint64_t useful = 0;
+	};
+
+public:
+	Scheduler(size_t threads = 1, bool use_caller = true, const std::string& name="Scheduler", QueueMode mode = SHARED_QUEUE);
 	virtual ~Scheduler();
 	
 	const std::string& getName() const {return m_name;}
 
+	// 回调任务结束后是否复用其协程
+	void setRecycleFibers(bool v) {m_recycleFibers = v;}
+
+	WakeupStats getWakeupStats() const;
+
 public:	
 	// 获取正在运行的调度器
 	static Scheduler* GetThis();
@@ -31,17 +59,41 @@ public:
     template <class FiberOrCb>
     void scheduleLock(FiberOrCb fc, int thread = -1) 
     {
+    	ScheduleTask task(fc, thread);
+    	if(!task.fiber && !task.cb)
+    	{
+    		return;
+    	}
+
+    	// 指定了线程 -> 直接放入该线程的mailbox 只唤醒该线程
+    	if(task.thread != -1 && scheduleMailbox(task))
+    	{
+    		return;
+    	}
+
+    	if(m_mode == WORK_STEALING)
+    	{
+    		scheduleStealing(task);
+    		return;
+    	}
+
+    	if(m_mode == LOCKFREE_QUEUE)
+    	{
+    		bool need_tickle = m_lockfreeTasks.empty();
+    		m_lockfreeTasks.push(std::move(task));
+    		if(need_tickle)
+    		{
+    			tickle();
+    		}
+    		return;
+    	}
+
     	bool need_tickle;
     	{
     		std::lock_guard<std::mutex> lock(m_mutex);
     		// empty ->  all thread is idle -> need to be waken up
     		need_tickle = m_tasks.empty();
-	        
-	        ScheduleTask task(fc, thread);
-	        if (task.fiber || task.cb) 
-	        {
-	            m_tasks.push_back(task);
-	        }
+	        m_tasks.push_back(std::move(task));
     	}
     	
     	if(need_tickle)
@@ -49,6 +101,9 @@ public:
     		tickle();
     	}
     }
+
+	// 一次提交多个协程 -> 只加一次锁 最多唤醒一个线程 取到任务的线程发现还有剩余时继续唤醒其他线程
+	void scheduleBatch(std::shared_ptr<Fiber>* fibers, size_t n);
 	
 	// 启动线程池
 	virtual void start();
@@ -57,6 +112,8 @@ public:
 	
 protected:
 	virtual void tickle();
+	// 唤醒指定的工作线程 -> 基类没有逐线程的唤醒手段 退化为tickle() 由IOManager按线程唤醒
+	virtual void tickleWorker(int index);
 	
 	// 线程函数
 	virtual void run();
@@ -69,6 +126,17 @@ protected:
 
 	bool hasIdleThreads() {return m_idleThreadCount>0;}
 
+	QueueMode getQueueMode() const {return m_mode;}
+	// 当前线程在该调度器中的编号 -> 不是该调度器的线程返回-1
+	int getWorkerIndex() const;
+	size_t getWorkerCount() const {return m_workers.size();}
+	int getWorkerThreadId(int index) const {return m_workers[index]->threadId;}
+
+	// 是否有index可以取到的任务 -> 线程挂起前再次检查 避免丢失唤醒
+	bool hasPendingTasks(int index);
+	// 子类唤醒了index -> 统计
+	void onWakeupSent(int index);
+
 private:
 	// 任务
 	struct ScheduleTask
@@ -84,16 +152,17 @@ private:
 			thread = -1;
 		}
 
+		// 共享栈协程只能在绑定的线程上恢复
 		ScheduleTask(std::shared_ptr<Fiber> f, int thr)
 		{
 			fiber = f;
-			thread = thr;
+			thread = (thr == -1 && fiber) ? fiber->getBoundThread() : thr;
 		}
 
 		ScheduleTask(std::shared_ptr<Fiber>* f, int thr)
 		{
 			fiber.swap(*f);
-			thread = thr;
+			thread = (thr == -1 && fiber) ? fiber->getBoundThread() : thr;
 		}	
 
 		ScheduleTask(std::function<void()> f, int thr)
@@ -116,14 +185,50 @@ private:
 		}	
 	};
 
+	// 工作线程的任务队列
+	struct Worker
+	{
+		std::mutex mutex;
+		// 本线程提交的任务 -> 本线程从头部取 其他线程从尾部窃取 -> WORK_STEALING模式使用
+		std::deque<ScheduleTask> tasks;
+		// 指定在本线程运行的任务 -> 所有模式都使用 不会被窃取
+		std::deque<ScheduleTask> mailbox;
+		// mailbox中的任务数 -> 不加锁检查是否为空
+		std::atomic<size_t> mailboxSize = {0};
+		// 被唤醒后尚未取到任务
+		std::atomic<bool> woken = {false};
+		// 线程id -> 线程启动后设置
+		std::atomic<int> threadId = {-1};
+	};
+
+private:
+	// 放入指定线程的mailbox -> 不是该调度器的线程返回false
+	bool scheduleMailbox(ScheduleTask& task);
+	bool dequeueMailbox(ScheduleTask& task, int index);
+
+	// WORK_STEALING模式下的提交与获取
+	void scheduleStealing(ScheduleTask& task);
+	bool dequeueStealing(ScheduleTask& task, int index);
+	// 从victim尾部窃取一半任务到index的本地队列 -> 返回其中一个
+	bool steal(ScheduleTask& task, int index, int victim);
+	// 根据线程id查找编号
+	int findWorker(int thread);
+
 private:
 	std::string m_name;
 	// 互斥锁 -> 保护任务队列
 	std::mutex m_mutex;
 	// 线程池
 	std::vector<std::shared_ptr<Thread>> m_threads;
-	// 任务队列
-	std::vector<ScheduleTask> m_tasks;
+	// 任务队列 -> SHARED_QUEUE模式使用 指定线程的任务放入mailbox
+	std::deque<ScheduleTask> m_tasks;
+	// 无锁任务队列 -> WORK_STEALING模式下作为外部提交的全局注入队列
+	UnboundedMPMCQueue<ScheduleTask> m_lockfreeTasks;
+	QueueMode m_mode;
+	// 每个工作线程一个 -> 编号0为主线程(use_caller时)
+	std::vector<std::unique_ptr<Worker>> m_workers;
+	// 所有本地队列和mailbox中的任务数
+	std::atomic<size_t> m_localTaskCount = {0};
 	// 存储工作线程的线程id
 	std::vector<int> m_threadIds;
 	// 需要额外创建的线程数
@@ -132,6 +237,9 @@ private:
 	std::atomic<size_t> m_activeThreadCount = {0};
 	// 空闲线程数
 	std::atomic<size_t> m_idleThreadCount = {0};
+	// 唤醒统计
+	std::atomic<uint64_t> m_wakeupsSent = {0};
+	std::atomic<uint64_t> m_wakeupsUseful = {0};
 
 	// 主线程是否用作工作线程
 	bool m_useCaller;
@@ -141,6 +249,8 @@ private:
 	int m_rootThread = -1;
 	// 是否正在关闭
 	bool m_stopping = false;	
+	// 是否复用回调任务的协程
+	bool m_recycleFibers = true;
 };
 
 }
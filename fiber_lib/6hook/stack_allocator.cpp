@@ -0,0 +1,348 @@
+#include "stack_allocator.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace sylar {
+
+// 统计信息
+static std::atomic<uint64_t> s_hits{0};
+static std::atomic<uint64_t> s_misses{0};
+static std::atomic<uint64_t> s_resident_bytes{0};
+static std::atomic<uint64_t> s_reserved_bytes{0};
+static std::atomic<uint64_t> s_cached_bytes{0};
+
+static std::atomic<int> s_default_type{StackAllocator::MALLOC_STACK};
+
+static size_t PageSize()
+{
+	static size_t page_size = sysconf(_SC_PAGESIZE);
+	return page_size;
+}
+
+static size_t ClassIndex(size_t size)
+{
+	size_t index = 0;
+	size_t class_size = StackAllocator::MIN_CLASS_SIZE;
+	while(class_size < size)
+	{
+		class_size <<= 1;
+		index++;
+	}
+	return index;
+}
+
+static size_t ClassSize(size_t index)
+{
+	return StackAllocator::MIN_CLASS_SIZE << index;
+}
+
+static void* SystemAlloc(size_t size, StackAllocator::Type type)
+{
+	s_misses++;
+	if(type == StackAllocator::MALLOC_STACK)
+	{
+		s_resident_bytes += size;
+		s_reserved_bytes += size;
+		return malloc(size);
+	}
+
+	// 只保留地址空间 -> 首次访问时才分配物理页
+	size_t guard = PageSize();
+	void* base = mmap(nullptr, size + guard, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+	if(base == MAP_FAILED)
+	{
+		return nullptr;
+	}
+	// 栈向低地址增长 -> 保护页放在最低处 溢出时触发SIGSEGV而不是破坏堆
+	if(mprotect(base, guard, PROT_NONE))
+	{
+		munmap(base, size + guard);
+		return nullptr;
+	}
+	s_reserved_bytes += size + guard;
+	return (char*)base + guard;
+}
+
+// 移入全局池的mmap栈 -> 释放栈顶KEEP_RESIDENT以外访问过的页 复用时重新按需缺页
+// 线程本地缓存不释放 -> 协程创建/销毁的快速路径上没有系统调用 驻留量以THREAD_CACHE_LIMIT为上限
+// 栈顶几页几乎每个协程都会用到 保留下来避免复用时立即缺页
+static const size_t KEEP_RESIDENT = 16 * 1024;
+
+static void ReleasePages(void* stack, size_t size, StackAllocator::Type type)
+{
+	if(type != StackAllocator::MMAP_STACK || size <= KEEP_RESIDENT)
+	{
+		return;
+	}
+	madvise(stack, size - KEEP_RESIDENT, MADV_DONTNEED);
+}
+
+static void SystemFree(void* stack, size_t size, StackAllocator::Type type)
+{
+	if(type == StackAllocator::MALLOC_STACK)
+	{
+		s_resident_bytes -= size;
+		s_reserved_bytes -= size;
+		free(stack);
+		return;
+	}
+
+	size_t guard = PageSize();
+	s_reserved_bytes -= size + guard;
+	munmap((char*)stack - guard, size + guard);
+}
+
+// 全局池 -> 线程本地缓存溢出时使用
+struct GlobalPool
+{
+	std::mutex mutex;
+	std::vector<void*> stacks[StackAllocator::TYPE_COUNT][StackAllocator::CLASS_COUNT];
+};
+
+static GlobalPool& GetGlobalPool()
+{
+	// 不析构 -> 其他线程退出时仍可能归还栈
+	static GlobalPool* pool = new GlobalPool();
+	return *pool;
+}
+
+// 线程本地缓存
+struct ThreadCache
+{
+	std::vector<void*> stacks[StackAllocator::TYPE_COUNT][StackAllocator::CLASS_COUNT];
+
+	// 从全局池取出一批
+	void refill(StackAllocator::Type type, size_t index)
+	{
+		GlobalPool& pool = GetGlobalPool();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		std::vector<void*>& from = pool.stacks[type][index];
+		std::vector<void*>& to = stacks[type][index];
+		size_t n = std::min(from.size(), StackAllocator::THREAD_CACHE_LIMIT / 2);
+		to.insert(to.end(), from.end() - n, from.end());
+		from.resize(from.size() - n);
+	}
+
+	// 归还count个到全局池 -> 全局池已满则归还系统
+	void flush(StackAllocator::Type type, size_t index, size_t count)
+	{
+		std::vector<void*>& from = stacks[type][index];
+		count = std::min(count, from.size());
+		size_t size = ClassSize(index);
+		// 放入全局池之前释放 -> 之后其他线程随时可能取走使用
+		for(size_t i=0;i<count;i++)
+		{
+			ReleasePages(from[from.size() - 1 - i], size, type);
+		}
+		{
+			GlobalPool& pool = GetGlobalPool();
+			std::lock_guard<std::mutex> lock(pool.mutex);
+			std::vector<void*>& to = pool.stacks[type][index];
+			while(count > 0 && to.size() < StackAllocator::GLOBAL_POOL_LIMIT)
+			{
+				to.push_back(from.back());
+				from.pop_back();
+				count--;
+			}
+		}
+		while(count > 0)
+		{
+			s_cached_bytes -= size;
+			SystemFree(from.back(), size, type);
+			from.pop_back();
+			count--;
+		}
+	}
+
+	~ThreadCache()
+	{
+		for(int t=0;t<StackAllocator::TYPE_COUNT;t++)
+		{
+			for(size_t i=0;i<StackAllocator::CLASS_COUNT;i++)
+			{
+				flush((StackAllocator::Type)t, i, stacks[t][i].size());
+			}
+		}
+	}
+};
+
+static thread_local ThreadCache* t_cache = nullptr;
+// 线程退出时析构 -> 此后该线程直接使用全局池
+static thread_local bool t_cache_destroyed = false;
+
+struct ThreadCacheHolder
+{
+	~ThreadCacheHolder()
+	{
+		delete t_cache;
+		t_cache = nullptr;
+		t_cache_destroyed = true;
+	}
+};
+
+static thread_local ThreadCacheHolder t_cache_holder;
+
+static ThreadCache* GetThreadCache()
+{
+	if(t_cache == nullptr && !t_cache_destroyed)
+	{
+		// 访问holder -> 确保线程退出时析构
+		(void)&t_cache_holder;
+		t_cache = new ThreadCache();
+	}
+	return t_cache;
+}
+
+size_t StackAllocator::RoundUp(size_t size)
+{
+	if(size > ClassSize(CLASS_COUNT - 1))
+	{
+		// 不缓存的栈按页对齐
+		return (size + PageSize() - 1) & ~(PageSize() - 1);
+	}
+	return ClassSize(ClassIndex(size));
+}
+
+void* StackAllocator::Alloc(size_t size, Type type)
+{
+	if(size > ClassSize(CLASS_COUNT - 1))
+	{
+		return SystemAlloc(size, type);
+	}
+
+	size_t index = ClassIndex(size);
+	ThreadCache* cache = GetThreadCache();
+	if(cache)
+	{
+		std::vector<void*>& stacks = cache->stacks[type][index];
+		if(stacks.empty())
+		{
+			cache->refill(type, index);
+		}
+		if(!stacks.empty())
+		{
+			void* stack = stacks.back();
+			stacks.pop_back();
+			s_hits++;
+			s_cached_bytes -= size;
+			return stack;
+		}
+	}
+	else
+	{
+		GlobalPool& pool = GetGlobalPool();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		std::vector<void*>& stacks = pool.stacks[type][index];
+		if(!stacks.empty())
+		{
+			void* stack = stacks.back();
+			stacks.pop_back();
+			s_hits++;
+			s_cached_bytes -= size;
+			return stack;
+		}
+	}
+	return SystemAlloc(size, type);
+}
+
+void StackAllocator::Dealloc(void* stack, size_t size, Type type)
+{
+	if(stack == nullptr)
+	{
+		return;
+	}
+
+	if(size > ClassSize(CLASS_COUNT - 1))
+	{
+		SystemFree(stack, size, type);
+		return;
+	}
+
+	size_t index = ClassIndex(size);
+	s_cached_bytes += size;
+	ThreadCache* cache = GetThreadCache();
+	if(cache)
+	{
+		std::vector<void*>& stacks = cache->stacks[type][index];
+		stacks.push_back(stack);
+		if(stacks.size() > THREAD_CACHE_LIMIT)
+		{
+			// 保留一半 -> 避免在边界上反复与全局池交换
+			cache->flush(type, index, THREAD_CACHE_LIMIT / 2);
+		}
+		return;
+	}
+
+	ReleasePages(stack, size, type);
+	{
+		GlobalPool& pool = GetGlobalPool();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		std::vector<void*>& stacks = pool.stacks[type][index];
+		if(stacks.size() < GLOBAL_POOL_LIMIT)
+		{
+			stacks.push_back(stack);
+			return;
+		}
+	}
+	s_cached_bytes -= size;
+	SystemFree(stack, size, type);
+}
+
+void StackAllocator::SetDefaultType(Type type)
+{
+	s_default_type = type;
+}
+
+StackAllocator::Type StackAllocator::GetDefaultType()
+{
+	return (Type)s_default_type.load();
+}
+
+size_t StackAllocator::GetResidentSize(void* stack, size_t size)
+{
+	if(stack == nullptr)
+	{
+		return 0;
+	}
+
+	// mincore要求起始地址按页对齐
+	size_t page = PageSize();
+	uintptr_t begin = (uintptr_t)stack & ~(page - 1);
+	uintptr_t end = ((uintptr_t)stack + size + page - 1) & ~(page - 1);
+	size_t pages = (end - begin) / page;
+
+	std::vector<unsigned char> vec(pages);
+	if(mincore((void*)begin, end - begin, vec.data()))
+	{
+		return 0;
+	}
+
+	size_t resident = 0;
+	for(size_t i=0;i<pages;i++)
+	{
+		if(vec[i] & 1)
+		{
+			resident += page;
+		}
+	}
+	return resident;
+}
+
+StackAllocator::Stats StackAllocator::GetStats()
+{
+	Stats stats;
+	stats.hits = s_hits;
+	stats.misses = s_misses;
+	stats.resident_bytes = s_resident_bytes;
+	stats.reserved_bytes = s_reserved_bytes;
+	stats.cached_bytes = s_cached_bytes;
+	return stats;
+}
+
+}
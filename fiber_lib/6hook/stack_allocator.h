@@ -0,0 +1,68 @@
+#ifndef _STACK_ALLOCATOR_H_
+#define _STACK_ALLOCATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace sylar {
+
+// 协程栈分配器
+// 按大小分级 -> 每个线程一份本地缓存 -> 本地缓存满/空时与全局池批量交换 -> 全局池满时归还系统
+class StackAllocator
+{
+public:
+	enum Type
+	{
+		// malloc分配 -> 视为全部驻留
+		MALLOC_STACK,
+		// mmap分配 -> 栈底一页PROT_NONE保护页 -> 按需缺页 只有访问过的页驻留
+		// 移入全局池时释放栈顶16KB以外的页 -> 线程本地缓存中的栈保持驻留 复用时不缺页
+		// 注意: 每个栈占用两个映射区 大量协程时需要调大 vm.max_map_count
+		MMAP_STACK,
+		TYPE_COUNT
+	};
+
+	// 最小的栈大小级别 64KB -> 每级翻倍
+	static const size_t MIN_CLASS_SIZE = 64 * 1024;
+	// 级别数: 64KB 128KB 256KB 512KB 1MB -> 更大的栈不缓存
+	static const size_t CLASS_COUNT = 5;
+	// 每个线程每个级别最多缓存的栈数
+	static const size_t THREAD_CACHE_LIMIT = 64;
+	// 全局池每个级别最多缓存的栈数
+	static const size_t GLOBAL_POOL_LIMIT = 1024;
+
+	struct Stats
+	{
+		// 从缓存中分配成功
+		uint64_t hits = 0;
+		// 缓存为空 -> 向系统申请
+		uint64_t misses = 0;
+		// 向系统申请且尚未归还的malloc栈字节数(使用中 + 缓存中)
+		uint64_t resident_bytes = 0;
+		// 向系统申请且尚未归还的全部栈地址空间(含保护页)
+		uint64_t reserved_bytes = 0;
+		// 缓存中的字节数
+		uint64_t cached_bytes = 0;
+	};
+
+public:
+	// 向上取整到级别大小
+	static size_t RoundUp(size_t size);
+
+	// size应为RoundUp()之后的大小
+	static void* Alloc(size_t size, Type type);
+	static void Dealloc(void* stack, size_t size, Type type);
+
+	// 新建协程默认使用的栈类型
+	static void SetDefaultType(Type type);
+	static Type GetDefaultType();
+
+	// 栈中实际驻留内存的字节数 -> mincore
+	static size_t GetResidentSize(void* stack, size_t size);
+
+	static Stats GetStats();
+};
+
+}
+
+#endif
@@ -0,0 +1,203 @@
+// 通道的行为测试 -> 关闭语义 缓冲区满时阻塞 Select同时有多个分支就绪
+// 全部通过时返回0 否则打印失败的检查并返回1
+#include "../ioscheduler.h"
+#include "../channel.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+
+using namespace sylar;
+
+static int s_failed = 0;
+
+#define CHECK(cond) \
+	do \
+	{ \
+		if(!(cond)) \
+		{ \
+			std::cout << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+			s_failed++; \
+		} \
+	} while(0)
+
+static const int THREADS = 4;
+
+// 关闭后send()失败 缓冲区中的值仍按顺序取出 取完后recv()失败
+static void TestCloseDrain()
+{
+	Channel<std::string> ch(4);
+	CHECK(ch.send("a"));
+	CHECK(ch.send("b"));
+	CHECK(ch.send("c"));
+	ch.close();
+	CHECK(ch.isClosed());
+
+	CHECK(!ch.send("d"));
+	std::string v = "kept";
+	CHECK(!ch.trySend(std::move(v)));
+	CHECK(v == "kept");
+
+	std::string out;
+	CHECK(ch.recv(out) && out == "a");
+	CHECK(ch.tryRecv(out) && out == "b");
+	CHECK(ch.recv(out) && out == "c");
+	CHECK(!ch.recv(out));
+	CHECK(!ch.tryRecv(out));
+	CHECK(ch.size() == 0);
+}
+
+// 缓冲区满时发送方挂起 取走一个后继续 关闭唤醒仍挂起的发送方和接收方并返回false
+static void TestBlockOnFull()
+{
+	Channel<int> ch(2);
+	Channel<int> empty(0);
+	std::atomic<int> sent = {0};
+	std::atomic<int> blocked_send = {-1};
+	std::atomic<int> blocked_recv = {-1};
+	{
+		IOManager iom(THREADS, false);
+		iom.scheduleLock([&]()
+		{
+			for(int i=0;i<3;i++)
+			{
+				if(ch.send(i))
+				{
+					sent++;
+				}
+			}
+			// 缓冲区又满了 -> 挂起到close()
+			blocked_send = ch.send(3) ? 1 : 0;
+		});
+		iom.scheduleLock([&]()
+		{
+			int v;
+			blocked_recv = empty.recv(v) ? 1 : 0;
+		});
+
+		usleep(50000);
+		CHECK(sent == 2);
+		CHECK(ch.size() == 2);
+
+		int v = -1;
+		CHECK(ch.recv(v) && v == 0);
+		usleep(50000);
+		CHECK(sent == 3);
+		CHECK(ch.size() == 2);
+		CHECK(blocked_send == -1);
+		CHECK(blocked_recv == -1);
+
+		ch.close();
+		empty.close();
+		usleep(50000);
+		CHECK(blocked_send == 0);
+		CHECK(blocked_recv == 0);
+
+		// 关闭前已进入缓冲区的值不丢失
+		CHECK(ch.recv(v) && v == 1);
+		CHECK(ch.recv(v) && v == 2);
+		CHECK(!ch.recv(v));
+	}
+}
+
+// 两个分支同时就绪 -> 按添加顺序选中第一个 只完成这一个分支 另一个通道不受影响
+static void TestSelectTwoReady()
+{
+	Channel<int> a(1);
+	Channel<int> b(1);
+	CHECK(a.send(1));
+	CHECK(b.send(2));
+
+	int va = 0;
+	int vb = 0;
+	Select first;
+	first.recv(a, va).recv(b, vb);
+	CHECK(first.wait() == 0);
+	CHECK(!first.closed());
+	CHECK(va == 1 && vb == 0);
+	CHECK(a.size() == 0 && b.size() == 1);
+
+	Select second;
+	second.recv(a, va).recv(b, vb);
+	CHECK(second.wait() == 1);
+	CHECK(vb == 2);
+	CHECK(second.tryWait() == -1);
+
+	// 一个可发送一个已关闭 -> 同样选第一个
+	Channel<int> full(1);
+	CHECK(full.send(0));
+	b.close();
+	int out = 7;
+	Select third;
+	third.send(a, out).recv(b, vb).recv(full, va);
+	CHECK(third.wait() == 0);
+	CHECK(a.size() == 1 && full.size() == 1);
+
+	Select fourth;
+	fourth.recv(b, vb).recv(full, va);
+	CHECK(fourth.wait() == 0);
+	CHECK(fourth.closed());
+	CHECK(full.size() == 1);
+}
+
+// 挂起的Select由其他线程上的Select完成 -> 双方都有两个分支 每轮只交换一个值
+static void TestSelectWake()
+{
+	const int ROUNDS = 200;
+
+	Channel<int> a(0);
+	Channel<int> b(0);
+	std::atomic<int> got = {0};
+	std::atomic<int> delivered = {0};
+	{
+		IOManager iom(THREADS, false);
+		iom.scheduleLock([&]()
+		{
+			for(int i=0;i<ROUNDS;i++)
+			{
+				int va = -1;
+				int vb = -1;
+				Select select;
+				select.recv(a, va).recv(b, vb);
+				int index = select.wait();
+				if(index == 0 ? va == i : vb == i)
+				{
+					got++;
+				}
+			}
+		});
+		for(int i=0;i<ROUNDS;i++)
+		{
+			// 同一个值同时挂到两个通道上 -> 只有一个分支生效
+			std::atomic<int> done = {0};
+			iom.scheduleLock([&, i]()
+			{
+				Select select;
+				int va = i;
+				int vb = i;
+				select.send(a, va).send(b, vb);
+				select.wait();
+				delivered++;
+				done = 1;
+			});
+			while(!done)
+			{
+				usleep(100);
+			}
+		}
+	}
+	CHECK(got == ROUNDS);
+	CHECK(delivered == ROUNDS);
+}
+
+int main()
+{
+	TestCloseDrain();
+	TestBlockOnFull();
+	TestSelectTwoReady();
+	TestSelectWake();
+
+	std::cout << (s_failed ? "channel_test failed" : "channel_test passed") << std::endl;
+	return s_failed ? 1 : 0;
+}
@@ -0,0 +1,172 @@
+// Future/Promise的行为测试 -> go()的异常经get()重新抛出 when_any得到最先完成的 when_all等到全部完成
+// get()在协程中挂起 在普通线程中阻塞线程
+// 全部通过时返回0 否则打印失败的检查并返回1
+#include "../ioscheduler.h"
+#include "../future.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+using namespace sylar;
+
+static int s_failed = 0;
+
+#define CHECK(cond) \
+	do \
+	{ \
+		if(!(cond)) \
+		{ \
+			std::cout << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+			s_failed++; \
+		} \
+	} while(0)
+
+static const int THREADS = 4;
+
+// 取出异常的描述 -> 没有抛出返回空串
+template <class T>
+static std::string ThrownBy(Future<T>& future)
+{
+	try
+	{
+		future.get();
+	}
+	catch(const std::future_error& e)
+	{
+		return e.code() == std::future_errc::broken_promise ? "broken_promise" : e.what();
+	}
+	catch(const std::exception& e)
+	{
+		return e.what();
+	}
+	return "";
+}
+
+// fn抛出的异常由get()重新抛出 -> 协程中和普通线程中 值和void都一样
+static void TestException(IOManager& iom)
+{
+	// 普通线程
+	Future<int> f = go([]() -> int {throw std::runtime_error("from go");}, &iom);
+	CHECK(ThrownBy(f) == "from go");
+
+	Future<void> v = go([](){usleep(1000); throw std::logic_error("void");}, &iom);
+	CHECK(ThrownBy(v) == "void");
+
+	// 协程中 -> 嵌套的go()使用当前调度器
+	Future<bool> nested = go([]()
+	{
+		Future<std::string> inner = go([]() -> std::string {throw std::out_of_range("inner");});
+		return ThrownBy(inner) == "inner";
+	}, &iom);
+	CHECK(nested.get());
+
+	// 没有设置结果就销毁Promise -> broken_promise
+	Future<int> broken;
+	{
+		Promise<int> promise;
+		broken = promise.getFuture();
+	}
+	CHECK(ThrownBy(broken) == "broken_promise");
+}
+
+// when_any的结果是最先完成的下标 其余的结果仍然可以取出
+static void TestWhenAny(IOManager& iom)
+{
+	std::vector<Future<int>> futures;
+	futures.push_back(go([](){usleep(150000); return 0;}, &iom));
+	futures.push_back(go([](){usleep(10000); return 1;}, &iom));
+	futures.push_back(go([](){usleep(80000); return 2;}, &iom));
+
+	Future<size_t> any = when_any(futures);
+	CHECK(any.get() == 1);
+	CHECK(!futures[0].ready());
+
+	for(size_t i=0;i<futures.size();i++)
+	{
+		CHECK(futures[i].get() == (int)i);
+	}
+
+	// 已经完成的 -> 立即完成
+	std::vector<Future<int>> ready;
+	ready.push_back(go([](){usleep(20000); return 0;}, &iom));
+	ready.push_back(go([](){return 1;}, &iom));
+	ready[1].wait();
+	CHECK(when_any(ready).get() == 1);
+	ready[0].wait();
+}
+
+// when_all在最后一个完成后才完成 -> 失败的结果也算完成 异常留给各自的get()
+static void TestWhenAll(IOManager& iom)
+{
+	const int TASKS = 32;
+
+	std::atomic<int> finished = {0};
+	std::vector<Future<int>> futures;
+	for(int i=0;i<TASKS;i++)
+	{
+		futures.push_back(go([&finished, i]() -> int
+		{
+			usleep(1000 * (i % 8));
+			finished++;
+			if(i == 5)
+			{
+				throw std::runtime_error("task 5");
+			}
+			return i * i;
+		}, &iom));
+	}
+
+	// 在协程中等待
+	Future<bool> all = go([&]()
+	{
+		when_all(futures).get();
+		return finished == TASKS;
+	}, &iom);
+	CHECK(all.get());
+
+	for(int i=0;i<TASKS;i++)
+	{
+		if(i == 5)
+		{
+			CHECK(ThrownBy(futures[i]) == "task 5");
+		}
+		else
+		{
+			CHECK(futures[i].get() == i * i);
+		}
+	}
+}
+
+// 普通线程中get() -> 阻塞到另一个线程上的协程设置结果
+static void TestPlainThreadGet(IOManager& iom)
+{
+	Promise<std::string> promise;
+	Future<std::string> future = promise.getFuture();
+	std::atomic<bool> set = {false};
+	iom.scheduleLock([&]()
+	{
+		usleep(50000);
+		set = true;
+		promise.setValue("late");
+	});
+	CHECK(!future.ready());
+	CHECK(future.get() == "late");
+	CHECK(set);
+}
+
+int main()
+{
+	{
+		IOManager iom(THREADS, false);
+		TestException(iom);
+		TestWhenAny(iom);
+		TestWhenAll(iom);
+		TestPlainThreadGet(iom);
+	}
+
+	std::cout << (s_failed ? "future_test failed" : "future_test passed") << std::endl;
+	return s_failed ? 1 : 0;
+}
@@ -0,0 +1,267 @@
+// 协程同步原语的行为测试 -> 多个工作线程上的协程同时使用
+// 条件变量的等待与唤醒 信号量计数 WaitGroup完成 读写锁的写者互斥
+// 全部通过时返回0 否则打印失败的检查并返回1
+#include "../ioscheduler.h"
+#include "../fiber_sync.h"
+
+#include <unistd.h>
+#include <atomic>
+#include <deque>
+#include <iostream>
+
+using namespace sylar;
+
+static int s_failed = 0;
+
+#define CHECK(cond) \
+	do \
+	{ \
+		if(!(cond)) \
+		{ \
+			std::cout << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+			s_failed++; \
+		} \
+	} while(0)
+
+static const int THREADS = 4;
+
+// 生产者逐个notify_one() 消费者带谓词等待 -> 每个元素恰好被取走一次 结束时notify_all()放行全部消费者
+static void TestCondVar()
+{
+	const int CONSUMERS = 16;
+	const int ITEMS = 2000;
+
+	FiberMutex mutex;
+	FiberCondVar cond;
+	std::deque<int> queue;
+	bool finished = false;
+	long sum = 0;
+	int consumed = 0;
+	WaitGroup wg;
+	wg.add(CONSUMERS + 1);
+	{
+		IOManager iom(THREADS, false);
+		for(int c=0;c<CONSUMERS;c++)
+		{
+			iom.scheduleLock([&]()
+			{
+				for(;;)
+				{
+					std::unique_lock<FiberMutex> lock(mutex);
+					cond.wait(lock, [&](){return !queue.empty() || finished;});
+					if(queue.empty())
+					{
+						break;
+					}
+					sum += queue.front();
+					queue.pop_front();
+					consumed++;
+				}
+				wg.done();
+			});
+		}
+		iom.scheduleLock([&]()
+		{
+			for(int i=1;i<=ITEMS;i++)
+			{
+				{
+					std::lock_guard<FiberMutex> lock(mutex);
+					queue.push_back(i);
+				}
+				cond.notify_one();
+				if(i % 100 == 0)
+				{
+					usleep(100);
+				}
+			}
+			{
+				std::lock_guard<FiberMutex> lock(mutex);
+				finished = true;
+			}
+			cond.notify_all();
+			wg.done();
+		});
+		wg.wait();
+	}
+	CHECK(consumed == ITEMS);
+	CHECK(sum == (long)ITEMS * (ITEMS + 1) / 2);
+}
+
+// 许可数为3 -> 同时持有的不超过3个 全部归还后计数恢复
+static void TestSemaphore()
+{
+	const int FIBERS = 32;
+	const int PERMITS = 3;
+
+	FiberSemaphore sem(PERMITS);
+	std::atomic<int> holding = {0};
+	std::atomic<int> max_holding = {0};
+	WaitGroup wg;
+	wg.add(FIBERS);
+	{
+		IOManager iom(THREADS, false);
+		for(int f=0;f<FIBERS;f++)
+		{
+			iom.scheduleLock([&]()
+			{
+				for(int i=0;i<5;i++)
+				{
+					sem.wait();
+					int now = ++holding;
+					int max = max_holding;
+					while(now > max && !max_holding.compare_exchange_weak(max, now));
+					usleep(200);
+					--holding;
+					sem.signal();
+				}
+				wg.done();
+			});
+		}
+		wg.wait();
+	}
+	CHECK(max_holding <= PERMITS);
+	CHECK(max_holding == PERMITS);
+
+	// 恰好PERMITS个许可 -> 再取一个失败
+	for(int i=0;i<PERMITS;i++)
+	{
+		CHECK(sem.tryWait());
+	}
+	CHECK(!sem.tryWait());
+	// 一次归还多个
+	sem.signal(2);
+	CHECK(sem.tryWait());
+	CHECK(sem.tryWait());
+	CHECK(!sem.tryWait());
+}
+
+// wait()在所有done()之后才返回 -> 协程中等待和普通线程中等待
+static void TestWaitGroup()
+{
+	const int TASKS = 64;
+
+	std::atomic<int> finished = {0};
+	std::atomic<int> early = {0};
+	WaitGroup tasks;
+	tasks.add(TASKS);
+	WaitGroup waiters;
+	waiters.add(THREADS);
+	{
+		IOManager iom(THREADS, false);
+		for(int w=0;w<THREADS;w++)
+		{
+			iom.scheduleLock([&]()
+			{
+				tasks.wait();
+				if(finished != TASKS)
+				{
+					early++;
+				}
+				waiters.done();
+			});
+		}
+		for(int t=0;t<TASKS;t++)
+		{
+			iom.scheduleLock([&, t]()
+			{
+				usleep(100 * (t % 8));
+				finished++;
+				tasks.done();
+			});
+		}
+		// 主线程不是协程 -> 阻塞线程等待
+		tasks.wait();
+		CHECK(finished == TASKS);
+		waiters.wait();
+	}
+	CHECK(early == 0);
+
+	// 计数已为0 -> 立即返回
+	WaitGroup empty;
+	empty.wait();
+}
+
+// 写者持锁期间没有读者也没有其他写者 读者之间可以并发
+static void TestRWMutex()
+{
+	const int READERS = 24;
+	const int WRITERS = 4;
+
+	FiberRWMutex rw;
+	std::atomic<int> readers = {0};
+	std::atomic<int> writers = {0};
+	std::atomic<int> max_readers = {0};
+	std::atomic<int> violations = {0};
+	long value = 0;
+	WaitGroup wg;
+	wg.add(READERS + WRITERS);
+	{
+		IOManager iom(THREADS, false);
+		for(int r=0;r<READERS;r++)
+		{
+			iom.scheduleLock([&]()
+			{
+				for(int i=0;i<20;i++)
+				{
+					rw.lock_shared();
+					int now = ++readers;
+					int max = max_readers;
+					while(now > max && !max_readers.compare_exchange_weak(max, now));
+					if(writers != 0)
+					{
+						violations++;
+					}
+					usleep(50);
+					--readers;
+					rw.unlock_shared();
+				}
+				wg.done();
+			});
+		}
+		for(int w=0;w<WRITERS;w++)
+		{
+			iom.scheduleLock([&]()
+			{
+				for(int i=0;i<20;i++)
+				{
+					rw.lock();
+					if(++writers != 1 || readers != 0)
+					{
+						violations++;
+					}
+					long v = value;
+					usleep(50);
+					value = v + 1;
+					--writers;
+					rw.unlock();
+				}
+				wg.done();
+			});
+		}
+		wg.wait();
+	}
+	CHECK(violations == 0);
+	CHECK(value == WRITERS * 20);
+	CHECK(max_readers > 1);
+
+	// 有读者时写锁失败 没有时成功
+	rw.lock_shared();
+	CHECK(!rw.try_lock());
+	CHECK(rw.try_lock_shared());
+	rw.unlock_shared();
+	rw.unlock_shared();
+	CHECK(rw.try_lock());
+	CHECK(!rw.try_lock_shared());
+	rw.unlock();
+}
+
+int main()
+{
+	TestCondVar();
+	TestSemaphore();
+	TestWaitGroup();
+	TestRWMutex();
+
+	std::cout << (s_failed ? "sync_test failed" : "sync_test passed") << std::endl;
+	return s_failed ? 1 : 0;
+}
@@ -1,107 +1,399 @@
 #include "timer.h"
 
+#include <algorithm>
+#include <thread>
+
 namespace sylar {
 
-bool Timer::cancel() 
+bool Timer::cancel()
 {
-    std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
+    return cancel(m_state >> 2);
+}
 
-    if(m_cb == nullptr) 
+bool Timer::cancel(uint64_t gen)
+{
+    uint64_t state = pack(gen, PENDING);
+    if(!m_state.compare_exchange_strong(state, pack(gen, CANCELLED)))
     {
         return false;
     }
-    else
+    --m_manager->m_count;
+
+    // 从时间轮移除 -> 所属线程处理
+    m_manager->update(this);
+    return true;
+}
+
+// refresh 只会向后调整
+bool Timer::refresh()
+{
+    if(getState() != PENDING)
     {
-        m_cb = nullptr;
+        return false;
     }
 
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it!=m_manager->m_timers.end())
+    m_due = m_manager->nowTick() + m_interval.load().count();
+    m_manager->update(this);
+    return true;
+}
+
+bool Timer::reset(uint64_t ms, bool from_now)
+{
+    std::chrono::microseconds interval = std::chrono::milliseconds(ms);
+    if(interval==m_interval.load() && !from_now)
     {
-        m_manager->m_timers.erase(it);
+        return true;
     }
+
+    if(getState() != PENDING)
+    {
+        return false;
+    }
+
+    // 移动到新位置
+    uint64_t start = from_now ? m_manager->nowTick() : m_due - m_interval.load().count();
+    m_interval = interval;
+    m_due = start + interval.count();
+    m_manager->update(this);
     return true;
 }
 
-// refresh 只会向后调整
-bool Timer::refresh() 
+Timer::Timer(std::chrono::microseconds interval, std::function<void()> cb, bool recurring, TimerManager* manager, std::chrono::microseconds slack):
+m_recurring(recurring), m_interval(interval), m_slack(slack), m_cb(cb), m_manager(manager)
 {
-    std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
+    m_due = manager->toTick(std::chrono::steady_clock::now() + interval);
+}
 
-    if(!m_cb) 
+bool TimerHandle::cancel()
+{
+    if(!m_timer)
     {
         return false;
     }
+    Timer* timer = m_timer;
+    m_timer = nullptr;
+    if(timer->cancel(m_gen))
+    {
+        return true;
+    }
 
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it==m_manager->m_timers.end())
+    // 回调正在所属线程上执行 -> 等它返回 在回调中取消自己则不等
+    while(timer->m_state == Timer::pack(m_gen, Timer::FIRING) && timer->m_manager->getTimerShard() != timer->m_shard)
     {
-        return false;
+        std::this_thread::yield();
     }
+    return false;
+}
 
-    m_manager->m_timers.erase(it);
-    m_next = std::chrono::system_clock::now() + std::chrono::milliseconds(m_ms);
-    m_manager->m_timers.insert(shared_from_this());
-    return true;
+TimerSlab::~TimerSlab()
+{
+    for(size_t i = 0; i < m_chunks.size(); ++i)
+    {
+        size_t used = i + 1 == m_chunks.size() ? m_used : CHUNK;
+        for(size_t j = 0; j < used; ++j)
+        {
+            m_chunks[i][j].~Timer();
+        }
+        ::operator delete(m_chunks[i]);
+    }
 }
 
-bool Timer::reset(uint64_t ms, bool from_now) 
+Timer* TimerSlab::alloc()
 {
-    if(ms==m_ms && !from_now)
+    Timer* timer = m_free;
+    if(timer)
     {
-        return true;
+        m_free = timer->m_after;
+        timer->m_after = nullptr;
     }
+    else
+    {
+        if(m_used == CHUNK)
+        {
+            m_chunks.push_back(static_cast<Timer*>(::operator new(sizeof(Timer) * CHUNK)));
+            m_used = 0;
+        }
+        timer = new (m_chunks.back() + m_used++) Timer();
+        timer->m_slab = this;
+    }
+    return timer;
+}
+
+void TimerSlab::free(Timer* timer)
+{
+    timer->m_after = m_free;
+    m_free = timer;
+}
 
+TimerWheel::TimerWheel(uint64_t now):
+m_now(now)
+{
+    for(int level = 0; level < LEVELS; ++level)
     {
-        std::unique_lock<std::shared_mutex> write_lock(m_manager->m_mutex);
-    
-        if(!m_cb) 
+        for(int index = 0; index < SLOTS; ++index)
         {
-            return false;
+            m_slots[level][index].level = level;
+            m_slots[level][index].index = index;
         }
-        
-        auto it = m_manager->m_timers.find(shared_from_this());
-        if(it==m_manager->m_timers.end())
+    }
+    m_overflow.level = -1;
+}
+
+void TimerWheel::insert(Timer* timer)
+{
+    ++m_size;
+    place(timer);
+}
+
+void TimerWheel::place(Timer* timer)
+{
+    // 已经过期 -> 下一次推进时到期
+    if(timer->m_expire < m_now)
+    {
+        timer->m_expire = m_now;
+    }
+    uint64_t expire = timer->m_expire;
+
+    // 与当前tick只有低(level+1)*LEVEL_BITS位不同 -> 放在第level层
+    for(int level = 0; level < LEVELS; ++level)
+    {
+        int shift = LEVEL_BITS * (level + 1);
+        if((expire >> shift) == (m_now >> shift))
         {
-            return false;
-        }   
-        m_manager->m_timers.erase(it); 
+            int index = (expire >> (LEVEL_BITS * level)) & (SLOTS - 1);
+            link(m_slots[level][index], timer);
+            m_bitmap[level] |= 1ull << index;
+            return;
+        }
     }
 
-    // reinsert
-    auto start = from_now ? std::chrono::system_clock::now() : m_next - std::chrono::milliseconds(m_ms);
-    m_ms = ms;
-    m_next = start + std::chrono::milliseconds(m_ms);
-    m_manager->addTimer(shared_from_this()); // insert with lock
-    return true;
+    link(m_overflow, timer);
+    m_overflowMin = std::min(m_overflowMin, expire);
+}
+
+void TimerWheel::link(TimerSlot& slot, Timer* timer)
+{
+    timer->m_slot = &slot;
+    timer->m_prev = nullptr;
+    timer->m_after = slot.head;
+    if(slot.head)
+    {
+        slot.head->m_prev = timer;
+    }
+    slot.head = timer;
+}
+
+Timer* TimerWheel::detach(TimerSlot& slot)
+{
+    Timer* head = slot.head;
+    slot.head = nullptr;
+    if(slot.level >= 0)
+    {
+        m_bitmap[slot.level] &= ~(1ull << slot.index);
+    }
+    else
+    {
+        m_overflowMin = ~0ull;
+    }
+    return head;
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager):
-m_recurring(recurring), m_ms(ms), m_cb(cb), m_manager(manager) 
+void TimerWheel::remove(Timer* timer)
 {
-    auto now = std::chrono::system_clock::now();
-    m_next = now + std::chrono::milliseconds(m_ms);
+    TimerSlot* slot = timer->m_slot;
+    assert(slot);
+
+    if(timer->m_prev)
+    {
+        timer->m_prev->m_after = timer->m_after;
+    }
+    else
+    {
+        slot->head = timer->m_after;
+    }
+    if(timer->m_after)
+    {
+        timer->m_after->m_prev = timer->m_prev;
+    }
+    timer->m_slot = nullptr;
+    timer->m_prev = nullptr;
+    timer->m_after = nullptr;
+
+    if(!slot->head)
+    {
+        detach(*slot);
+    }
+    --m_size;
+}
+
+uint64_t TimerWheel::nextTick() const
+{
+    // 第l层的槽都在当前SLOTS^(l+1)范围内 第l+1层的槽都在它之后 -> 第一个非空层就是最早的
+    for(int level = 0; level < LEVELS; ++level)
+    {
+        int cur = (m_now >> (LEVEL_BITS * level)) & (SLOTS - 1);
+        uint64_t bitmap = m_bitmap[level] & (~0ull << cur);
+        if(!bitmap)
+        {
+            continue;
+        }
+        int index = __builtin_ctzll(bitmap);
+        int shift = LEVEL_BITS * (level + 1);
+        return ((m_now >> shift) << shift) | ((uint64_t)index << (LEVEL_BITS * level));
+    }
+
+    if(m_overflow.head)
+    {
+        int shift = LEVEL_BITS * LEVELS;
+        return std::max(m_now, (m_overflowMin >> shift) << shift);
+    }
+    return ~0ull;
+}
+
+void TimerWheel::advance(uint64_t now, std::vector<Timer*>& expired)
+{
+    while(true)
+    {
+        // 直接跳到下一个非空槽
+        uint64_t next = nextTick();
+        if(next == ~0ull || next > now)
+        {
+            break;
+        }
+        m_now = next;
+
+        // 溢出链表进入范围 -> 重新插入
+        int shift = LEVEL_BITS * LEVELS;
+        if(m_overflow.head && (m_now >> shift) >= (m_overflowMin >> shift))
+        {
+            Timer* timer = detach(m_overflow);
+            while(timer)
+            {
+                Timer* after = timer->m_after;
+                place(timer);
+                timer = after;
+            }
+        }
+
+        // 进入高层某个槽的范围 -> 从高到低逐层下放
+        for(int level = LEVELS - 1; level > 0; --level)
+        {
+            uint64_t mask = (1ull << (LEVEL_BITS * level)) - 1;
+            if(m_now & mask)
+            {
+                continue;
+            }
+            int index = (m_now >> (LEVEL_BITS * level)) & (SLOTS - 1);
+            Timer* timer = detach(m_slots[level][index]);
+            while(timer)
+            {
+                Timer* after = timer->m_after;
+                place(timer);
+                timer = after;
+            }
+        }
+
+        // 第0层当前槽全部到期
+        Timer* timer = detach(m_slots[0][m_now & (SLOTS - 1)]);
+        while(timer)
+        {
+            Timer* after = timer->m_after;
+            timer->m_slot = nullptr;
+            timer->m_prev = nullptr;
+            timer->m_after = nullptr;
+            expired.push_back(timer);
+            --m_size;
+            timer = after;
+        }
+        ++m_now;
+    }
+
+    if(now + 1 > m_now)
+    {
+        m_now = now + 1;
+    }
+}
+
+void TimerWheel::drain(std::vector<Timer*>& expired, uint64_t now)
+{
+    auto take = [&](TimerSlot& slot)
+    {
+        Timer* timer = detach(slot);
+        while(timer)
+        {
+            Timer* after = timer->m_after;
+            timer->m_slot = nullptr;
+            timer->m_prev = nullptr;
+            timer->m_after = nullptr;
+            expired.push_back(timer);
+            timer = after;
+        }
+    };
+
+    for(int level = 0; level < LEVELS; ++level)
+    {
+        for(int index = 0; index < SLOTS; ++index)
+        {
+            take(m_slots[level][index]);
+        }
+    }
+    take(m_overflow);
+    m_size = 0;
+    m_now = now;
 }
 
-bool Timer::Comparator::operator()(const std::shared_ptr<Timer>& lhs, const std::shared_ptr<Timer>& rhs) const
+TimerManager::TimerManager(size_t shards)
 {
-    assert(lhs!=nullptr&&rhs!=nullptr);
-    return lhs->m_next < rhs->m_next;
+    m_base = std::chrono::steady_clock::now();
+    m_shards.resize(std::max<size_t>(shards, 1));
+    for(auto& shard : m_shards)
+    {
+        shard.reset(new Shard());
+    }
 }
 
-TimerManager::TimerManager() 
+TimerManager::~TimerManager()
 {
-    m_previouseTime = std::chrono::system_clock::now();
+    // 打破timer对自己的引用
+    for(auto& shard : m_shards)
+    {
+        std::vector<Timer*> timers;
+        shard->wheel.drain(timers, 0);
+        for(Timer* timer : timers)
+        {
+            timer->m_self.reset();
+        }
+
+        Timer* timer = shard->inbox.exchange(nullptr);
+        while(timer)
+        {
+            Timer* next = timer->m_inboxNext;
+            timer->m_queued = false;
+            timer->m_inboxSelf.reset();
+            timer = next;
+        }
+    }
 }
 
-TimerManager::~TimerManager() 
+std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring, std::chrono::microseconds slack)
 {
+    return addTimer(std::chrono::milliseconds(ms), cb, recurring, slack);
 }
 
-std::shared_ptr<Timer> TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring) 
+std::shared_ptr<Timer> TimerManager::addTimer(std::chrono::microseconds interval, std::function<void()> cb, bool recurring, std::chrono::microseconds slack)
 {
-    std::shared_ptr<Timer> timer(new Timer(ms, cb, recurring, this));
-    addTimer(timer);
+    std::shared_ptr<Timer> timer(new Timer(interval, cb, recurring, this, slack));
+
+    // 本线程的分片 -> 不拥有分片则轮流放入各分片
+    int shard = getTimerShard();
+    if(shard < 0)
+    {
+        shard = pickShard();
+    }
+    timer->m_shard = shard;
+
+    ++m_count;
+    update(timer.get());
     return timer;
 }
 
@@ -115,26 +407,49 @@ static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb)
     }
 }
 
-std::shared_ptr<Timer> TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring) 
+std::shared_ptr<Timer> TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring, std::chrono::microseconds slack)
 {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring, slack);
 }
 
 uint64_t TimerManager::getNextTimer()
 {
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    
-    // reset m_tickled
-    m_tickled = false;
-    
-    if (m_timers.empty())
+    uint64_t us = getNextTimerUs();
+    // 向上取整 -> 醒来时timer一定已经到期
+    return us == ~0ull ? ~0ull : (us + 999) / 1000;
+}
+
+uint64_t TimerManager::getNextTimerUs()
+{
+    int index = getTimerShard();
+    if(index < 0)
+    {
+        return ~0ull;
+    }
+    Shard& shard = *m_shards[index];
+    if(!shard.active)
+    {
+        shard.active = true;
+    }
+    drainInbox(shard);
+
+    uint64_t next = shard.wheel.nextTick();
+    // 先公布要睡到的tick 再检查收件箱 -> 与update()相反的顺序 两者至少有一方看到对方
+    shard.sleepTick = next;
+    if(shard.inbox.load() != nullptr)
+    {
+        shard.sleepTick = 0;
+        return 0;
+    }
+
+    if (next == ~0ull)
     {
         // 返回最大值
         return ~0ull;
     }
 
-    auto now = std::chrono::system_clock::now();
-    auto time = (*m_timers.begin())->m_next;
+    auto now = std::chrono::steady_clock::now();
+    auto time = m_base + std::chrono::microseconds(next);
 
     if(now>=time)
     {
@@ -143,81 +458,306 @@ uint64_t TimerManager::getNextTimer()
     }
     else
     {
-        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(time - now);
-        return static_cast<uint64_t>(duration.count());            
-    }  
+        auto duration = std::chrono::ceil<std::chrono::microseconds>(time - now);
+        return static_cast<uint64_t>(duration.count());
+    }
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs)
 {
-    auto now = std::chrono::system_clock::now();
+    int index = getTimerShard();
+    if(index < 0)
+    {
+        return;
+    }
+    Shard& shard = *m_shards[index];
+    // 已经醒来 -> 其他线程不必再唤醒
+    shard.sleepTick = 0;
+    drainInbox(shard);
 
-    std::unique_lock<std::shared_mutex> write_lock(m_mutex); 
+    auto now = std::chrono::steady_clock::now();
+
+    // 清理超时timer
+    std::vector<Timer*> expired;
+    uint64_t ticks = std::chrono::duration_cast<std::chrono::microseconds>(now - m_base).count();
+    shard.wheel.advance(ticks, expired);
+
+    // 同一tick到期的一组timer -> 没有slack时每个不同的到期时间各需要一次唤醒
+    std::vector<uint64_t> wanted;
+    for(size_t i = 0, j = 0; i < expired.size(); i = j)
+    {
+        for(j = i + 1; j < expired.size() && expired[j]->m_expire == expired[i]->m_expire; ++j);
+        if(j - i < 2)
+        {
+            continue;
+        }
+        wanted.clear();
+        for(size_t k = i; k < j; ++k)
+        {
+            Timer* timer = expired[k];
+            wanted.push_back(timer->m_slack.load().count() ? timer->m_due.load() : timer->m_expire);
+        }
+        std::sort(wanted.begin(), wanted.end());
+        shard.avoidedWakeups += std::unique(wanted.begin(), wanted.end()) - wanted.begin() - 1;
+    }
+
+    // 先决定每个timer的去向 再执行内联回调 -> 回调中取消/添加timer不会影响还没处理的
+    size_t inlines = 0;
+    for(Timer* timer : expired)
+    {
+        // 接管时间轮持有的引用
+        std::shared_ptr<Timer> temp = std::move(timer->m_self);
+
+        if (timer->m_recurring && timer->getState() == Timer::PENDING)
+        {
+            cbs.push_back(timer->m_cb);
+
+            // 重新加入时间轮 -> 其他线程已经reset到之后的时间则保留
+            uint64_t due = timer->m_due;
+            if(due <= ticks)
+            {
+                timer->m_due.compare_exchange_strong(due, ticks + timer->m_interval.load().count());
+            }
+            apply(timer);
+            continue;
+        }
+
+        uint64_t gen = timer->m_state >> 2;
+        uint64_t state = Timer::pack(gen, Timer::PENDING);
+        if(!timer->m_recurring && timer->m_state.compare_exchange_strong(state, Timer::pack(gen, timer->m_slab ? Timer::FIRING : Timer::DONE)))
+        {
+            --m_count;
+            if(timer->m_slab)
+            {
+                // 稍后执行
+                expired[inlines++] = timer;
+                continue;
+            }
+            cbs.push_back(std::move(timer->m_cb));
+        }
+        // 清理cb
+        timer->m_cb = nullptr;
+        release(timer);
+    }
+
+    for(size_t i = 0; i < inlines; ++i)
+    {
+        Timer* timer = expired[i];
+        timer->m_fn();
+        timer->m_fn.reset();
+        timer->m_state = Timer::pack(timer->m_state >> 2, Timer::DONE);
+        release(timer);
+    }
+}
+
+bool TimerManager::hasTimer()
+{
+    return m_count > 0;
+}
+
+uint64_t TimerManager::getAvoidedWakeups() const
+{
+    uint64_t avoided = 0;
+    for(auto& shard : m_shards)
+    {
+        avoided += shard->avoidedWakeups;
+    }
+    return avoided;
+}
 
-    bool rollover = detectClockRollover();
-    
-    // 回退 -> 清理所有timer || 超时 -> 清理超时timer
-    while (!m_timers.empty() && rollover || !m_timers.empty() && (*m_timers.begin())->m_next <= now)
+void TimerManager::update(Timer* timer)
+{
+    if(timer->m_shard == getTimerShard())
     {
-        std::shared_ptr<Timer> temp = *m_timers.begin();
-        m_timers.erase(m_timers.begin());
-        
-        cbs.push_back(temp->m_cb); 
+        // 所属线程正在运行 -> 睡眠前会重新计算超时 不需要唤醒
+        apply(timer);
+        return;
+    }
 
-        if (temp->m_recurring)
+    Shard& shard = *m_shards[timer->m_shard];
+    bool queued = false;
+    if(timer->m_queued.compare_exchange_strong(queued, true))
+    {
+        // 对象池中的timer不会被释放 -> 不需要持有
+        if(!timer->m_slab)
         {
-            // 重新加入时间堆
-            temp->m_next = now + std::chrono::milliseconds(temp->m_ms);
-            m_timers.insert(temp);
+            timer->m_inboxSelf = timer->shared_from_this();
         }
-        else
+        Timer* head = shard.inbox.load();
+        do
+        {
+            timer->m_inboxNext = head;
+        } while(!shard.inbox.compare_exchange_weak(head, timer));
+    }
+
+    if(timer->getState() != Timer::PENDING)
+    {
+        return;
+    }
+
+    // 比所属线程要睡到的更早 -> 只有把sleepTick改小的一方唤醒它
+    uint64_t due = coalesce(timer->m_due, timer->m_slack.load().count());
+    uint64_t sleep = shard.sleepTick;
+    while(due < sleep)
+    {
+        if(shard.sleepTick.compare_exchange_weak(sleep, due))
         {
-            // 清理cb
-            temp->m_cb = nullptr;
+            onTimerInsertedAtFront(timer->m_shard);
+            break;
         }
     }
 }
 
-bool TimerManager::hasTimer() 
+void TimerManager::apply(Timer* timer)
 {
-    std::shared_lock<std::shared_mutex> read_lock(m_mutex);
-    return !m_timers.empty();
+    TimerWheel& wheel = m_shards[timer->m_shard]->wheel;
+
+    if(timer->getState() != Timer::PENDING)
+    {
+        if(timer->m_slot)
+        {
+            wheel.remove(timer);
+            timer->m_self.reset();
+        }
+        timer->m_cb = nullptr;
+        release(timer);
+        return;
+    }
+
+    uint64_t expire = coalesce(timer->m_due, timer->m_slack.load().count());
+    if(timer->m_slot && timer->m_expire == expire)
+    {
+        return;
+    }
+    if(timer->m_slot)
+    {
+        wheel.remove(timer);
+    }
+    timer->m_expire = expire;
+    wheel.insert(timer);
+    if(!timer->m_slab && !timer->m_self)
+    {
+        timer->m_self = timer->shared_from_this();
+    }
 }
 
-// lock + tickle()
-void TimerManager::addTimer(std::shared_ptr<Timer> timer)
+void TimerManager::drainInbox(Shard& shard)
 {
-    bool at_front = false;
+    if(shard.inbox.load() == nullptr)
     {
-        std::unique_lock<std::shared_mutex> write_lock(m_mutex);
-        auto it = m_timers.insert(timer).first;
-        at_front = (it == m_timers.begin()) && !m_tickled;
-        
-        // only tickle once till one thread wakes up and runs getNextTime()
-        if(at_front)
+        return;
+    }
+
+    Timer* timer = shard.inbox.exchange(nullptr);
+    while(timer)
+    {
+        // 先取出再清除标记 -> 之后的请求重新加入收件箱
+        Timer* next = timer->m_inboxNext;
+        std::shared_ptr<Timer> temp = std::move(timer->m_inboxSelf);
+        timer->m_queued = false;
+
+        // 对象池中已经放回的timer -> 请求早已过时
+        if(!timer->m_slab || timer->m_live)
         {
-            m_tickled = true;
+            apply(timer);
         }
+        timer = next;
     }
-   
-    if(at_front)
+}
+
+Timer* TimerManager::allocTimer()
+{
+    int index = getTimerShard();
+    Timer* timer = nullptr;
+    if(index >= 0)
     {
-        // wake up 
-        onTimerInsertedAtFront();
+        timer = m_shards[index]->slab.alloc();
+    }
+    else
+    {
+        index = pickShard();
+        Shard& shard = *m_shards[index];
+        std::lock_guard<std::mutex> lock(shard.remoteMutex);
+        timer = shard.remoteSlab.alloc();
+    }
+    timer->m_shard = index;
+    timer->m_manager = this;
+    timer->m_live = true;
+    return timer;
+}
+
+TimerHandle TimerManager::startTimer(Timer* timer, std::chrono::microseconds interval, std::chrono::microseconds slack)
+{
+    timer->m_recurring = false;
+    timer->m_interval = interval;
+    timer->m_slack = slack;
+    timer->m_due = toTick(std::chrono::steady_clock::now() + interval);
+
+    // 新的一代 -> 之前的句柄全部失效
+    uint64_t gen = (timer->m_state >> 2) + 1;
+    timer->m_state = Timer::pack(gen, Timer::PENDING);
+
+    ++m_count;
+    update(timer);
+    return TimerHandle(timer, gen);
+}
+
+void TimerManager::release(Timer* timer)
+{
+    int state = timer->getState();
+    if(!timer->m_slab || !timer->m_live || timer->m_slot || timer->m_queued || state == Timer::PENDING || state == Timer::FIRING)
+    {
+        return;
+    }
+    timer->m_live = false;
+    timer->m_fn.reset();
+
+    Shard& shard = *m_shards[timer->m_shard];
+    if(timer->m_slab == &shard.slab)
+    {
+        shard.slab.free(timer);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(shard.remoteMutex);
+        shard.remoteSlab.free(timer);
     }
 }
 
-bool TimerManager::detectClockRollover() 
+int TimerManager::pickShard()
 {
-    bool rollover = false;
-    auto now = std::chrono::system_clock::now();
-    if(now < (m_previouseTime - std::chrono::milliseconds(60 * 60 * 1000))) 
+    size_t n = m_shards.size();
+    size_t start = m_nextShard++;
+    for(size_t i = 0; i < n; ++i)
     {
-        rollover = true;
+        size_t index = (start + i) % n;
+        if(m_shards[index]->active)
+        {
+            return index;
+        }
     }
-    m_previouseTime = now;
-    return rollover;
+    return start % n;
 }
 
+uint64_t TimerManager::coalesce(uint64_t due, uint64_t slack)
+{
+    if(slack == 0 || due == 0)
+    {
+        return due;
+    }
+    // due - 1与due + slack不同的最高位 -> 保留该位及以上 低位清零后仍不早于due
+    uint64_t last = due + slack;
+    int bit = 63 - __builtin_clzll((due - 1) ^ last);
+    return (last >> bit) << bit;
 }
 
+uint64_t TimerManager::toTick(std::chrono::time_point<std::chrono::steady_clock> time) const
+{
+    if(time <= m_base)
+    {
+        return 0;
+    }
+    return std::chrono::ceil<std::chrono::microseconds>(time - m_base).count();
+}
+
+}
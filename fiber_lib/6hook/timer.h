@@ -3,21 +3,110 @@
 
 #include <memory>
 #include <vector>
-#include <set>
-#include <shared_mutex>
 #include <assert.h>
 #include <functional>
 #include <mutex>
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <cstddef>
+#include <type_traits>
 
 namespace sylar {
 
 class TimerManager;
+class TimerWheel;
+class TimerSlab;
+class Timer;
 
-class Timer : public std::enable_shared_from_this<Timer> 
+// 小对象内联保存的回调 -> 捕获不超过CAPACITY字节时不分配内存 超过时退化为堆上分配
+class InlineCallback
+{
+public:
+    static const size_t CAPACITY = 48;
+
+    InlineCallback() = default;
+    ~InlineCallback() {reset();}
+    InlineCallback(const InlineCallback&) = delete;
+    InlineCallback& operator=(const InlineCallback&) = delete;
+
+    template <class F>
+    void assign(F&& f)
+    {
+        typedef typename std::decay<F>::type Fn;
+        reset();
+        if(sizeof(Fn) <= CAPACITY && alignof(Fn) <= alignof(std::max_align_t))
+        {
+            new (m_storage) Fn(std::forward<F>(f));
+            m_invoke = [](void* p) {(*static_cast<Fn*>(p))();};
+            m_destroy = [](void* p) {static_cast<Fn*>(p)->~Fn();};
+        }
+        else
+        {
+            *reinterpret_cast<Fn**>(m_storage) = new Fn(std::forward<F>(f));
+            m_invoke = [](void* p) {(**static_cast<Fn**>(p))();};
+            m_destroy = [](void* p) {delete *static_cast<Fn**>(p);};
+        }
+    }
+
+    void operator()() {m_invoke(m_storage);}
+    explicit operator bool() const {return m_invoke != nullptr;}
+
+    void reset()
+    {
+        if(m_destroy)
+        {
+            m_destroy(m_storage);
+        }
+        m_invoke = nullptr;
+        m_destroy = nullptr;
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char m_storage[CAPACITY];
+    void (*m_invoke)(void*) = nullptr;
+    void (*m_destroy)(void*) = nullptr;
+};
+
+// addInlineTimer()返回的句柄 -> 只记录对象和代数 不持有引用
+// timer对象来自所属分片的对象池 TimerManager析构前不会释放 -> 过期的句柄只会因代数不符而失效
+class TimerHandle
 {
     friend class TimerManager;
 public:
-    // 从时间堆中删除timer
+    TimerHandle() = default;
+
+    // 到期前取消 -> true
+    // 已经到期 -> 等正在其他线程执行的回调返回后返回false 之后回调不会再访问任何东西
+    bool cancel();
+
+    explicit operator bool() const {return m_timer != nullptr;}
+
+private:
+    TimerHandle(Timer* timer, uint64_t gen): m_timer(timer), m_gen(gen) {}
+
+private:
+    Timer* m_timer = nullptr;
+    uint64_t m_gen = 0;
+};
+
+// 时间轮的一个槽 -> timer组成的侵入式双向链表
+struct TimerSlot
+{
+    Timer* head = nullptr;
+    // 所在层 -1表示溢出链表
+    int level = 0;
+    int index = 0;
+};
+
+class Timer : public std::enable_shared_from_this<Timer>
+{
+    friend class TimerManager;
+    friend class TimerWheel;
+    friend class TimerSlab;
+    friend class TimerHandle;
+public:
+    // 从时间轮中删除timer
     bool cancel();
     // 刷新timer
     bool refresh();
@@ -25,71 +114,245 @@ public:
     bool reset(uint64_t ms, bool from_now);
 
 private:
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager* manager);
- 
+    Timer(std::chrono::microseconds interval, std::function<void()> cb, bool recurring, TimerManager* manager, std::chrono::microseconds slack);
+    // 对象池中的timer
+    Timer() = default;
+
+    // 只在状态为gen代的PENDING时取消
+    bool cancel(uint64_t gen);
+
 private:
+    // 任何线程都可以修改状态 -> 时间轮只由所属分片的线程修改
+    enum State
+    {
+        // 等待到期
+        PENDING,
+        // 已取消
+        CANCELLED,
+        // 内联回调正在所属线程上执行
+        FIRING,
+        // 已触发(非循环)
+        DONE
+    };
+
+    // 低2位为状态 其余为代数 -> 对象池中的timer每次重用代数加一
+    static uint64_t pack(uint64_t gen, int state) {return gen << 2 | state;}
+    int getState() const {return m_state & 3;}
+
+    std::atomic<uint64_t> m_state = {PENDING};
     // 是否循环
     bool m_recurring = false;
     // 超时时间
-    uint64_t m_ms = 0;
-    // 绝对超时时间
-    std::chrono::time_point<std::chrono::system_clock> m_next;
-    // 超时时触发的回调函数
+    std::atomic<std::chrono::microseconds> m_interval;
+    // 应当到期的tick -> 其他线程refresh/reset后由所属线程移动到新位置
+    std::atomic<uint64_t> m_due = {0};
+    // 允许推迟的时间 -> 实际在[m_due, m_due + m_slack]内与其他timer一起到期
+    std::atomic<std::chrono::microseconds> m_slack;
+    // 超时时触发的回调函数 -> 只由所属线程读写
     std::function<void()> m_cb;
+    // 对象池中的timer -> 到期时直接在所属线程上执行
+    InlineCallback m_fn;
+    // 所在的对象池 nullptr -> 由shared_ptr管理
+    TimerSlab* m_slab = nullptr;
     // 管理此timer的管理器
     TimerManager* m_manager = nullptr;
+    // 所属分片
+    int m_shard = 0;
+
+    // 以下只由所属线程访问
+    // 到期的tick
+    uint64_t m_expire = 0;
+    // 所在的槽 nullptr -> 不在时间轮中
+    TimerSlot* m_slot = nullptr;
+    Timer* m_prev = nullptr;
+    Timer* m_after = nullptr;
+    // 在时间轮中时持有自己 -> 用户丢弃返回的shared_ptr后timer仍然有效
+    std::shared_ptr<Timer> m_self;
+    // 对象池中的timer是否正在使用
+    bool m_live = false;
+
+    // 其他线程的请求 -> 已在所属分片的收件箱中时不重复加入
+    std::atomic<bool> m_queued = {false};
+    Timer* m_inboxNext = nullptr;
+    // 在收件箱中时持有自己
+    std::shared_ptr<Timer> m_inboxSelf;
+};
+
+// 分层时间轮 -> LEVELS层 每层SLOTS个槽 插入/删除O(1)
+// 第l层的一个槽覆盖SLOTS^l个tick 进入该槽的时间范围时逐层下放(cascade) 最终在第0层精确到期
+// 每层用一个64位图记录非空槽 -> 推进时直接跳到下一个非空槽 不逐tick遍历
+class TimerWheel
+{
+public:
+    static const int LEVEL_BITS = 6;
+    static const int SLOTS = 1 << LEVEL_BITS;
+    static const int LEVELS = 6;
+
+    explicit TimerWheel(uint64_t now = 0);
+
+    // 按timer->m_expire插入 已经过期的放到当前tick
+    void insert(Timer* timer);
+    void remove(Timer* timer);
+
+    // 最早可能到期的tick(下界) 没有timer返回~0ull
+    uint64_t nextTick() const;
+    // 推进到tick now(包含) 到期的timer按到期顺序移入expired
+    void advance(uint64_t now, std::vector<Timer*>& expired);
+    // 移出所有timer 并把当前tick设为now
+    void drain(std::vector<Timer*>& expired, uint64_t now);
+
+    size_t size() const {return m_size;}
+    bool empty() const {return m_size == 0;}
 
 private:
-    // 实现最小堆的比较函数
-    struct Comparator 
-    {
-        bool operator()(const std::shared_ptr<Timer>& lhs, const std::shared_ptr<Timer>& rhs) const;
-    };
+    // 按当前tick选择层和槽
+    void place(Timer* timer);
+    void link(TimerSlot& slot, Timer* timer);
+    // 取下整个槽
+    Timer* detach(TimerSlot& slot);
+
+private:
+    TimerSlot m_slots[LEVELS][SLOTS];
+    // 超出最高层范围的timer -> 当前tick进入它们所在的范围时重新插入
+    TimerSlot m_overflow;
+    uint64_t m_overflowMin = ~0ull;
+    // 每层的非空槽
+    uint64_t m_bitmap[LEVELS] = {0};
+    // 下一个要处理的tick
+    uint64_t m_now = 0;
+    size_t m_size = 0;
+};
+
+// timer对象池 -> 按块分配 对象只在析构时释放
+class TimerSlab
+{
+public:
+    TimerSlab() = default;
+    ~TimerSlab();
+    TimerSlab(const TimerSlab&) = delete;
+    TimerSlab& operator=(const TimerSlab&) = delete;
+
+    Timer* alloc();
+    void free(Timer* timer);
+
+private:
+    static const size_t CHUNK = 64;
+
+    std::vector<Timer*> m_chunks;
+    // 最后一块中已构造的数量
+    size_t m_used = CHUNK;
+    // 空闲链表 -> 通过m_after链接
+    Timer* m_free = nullptr;
 };
 
-class TimerManager 
+// 每个工作线程一个分片(时间轮) -> 到期处理和计算超时只访问本线程的分片 不加锁
+// 其他线程添加/取消/重设的timer通过所属分片的无锁收件箱交给所属线程
+class TimerManager
 {
     friend class Timer;
+    friend class TimerHandle;
 public:
-    TimerManager();
+    // shards -> 分片数 通常等于工作线程数
+    explicit TimerManager(size_t shards = 1);
     virtual ~TimerManager();
 
     // 添加timer
-    std::shared_ptr<Timer> addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    // slack -> 允许推迟到期的时间 窗口内的timer对齐到同一个tick一起到期 减少唤醒次数
+    std::shared_ptr<Timer> addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false, std::chrono::microseconds slack = std::chrono::microseconds(0));
+    // 微秒精度
+    std::shared_ptr<Timer> addTimer(std::chrono::microseconds interval, std::function<void()> cb, bool recurring = false, std::chrono::microseconds slack = std::chrono::microseconds(0));
 
     // 添加条件timer
-    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
+    std::shared_ptr<Timer> addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false, std::chrono::microseconds slack = std::chrono::microseconds(0));
+
+    // 添加一次性timer -> 对象来自本线程分片的对象池 回调内联保存 稳定后不分配内存
+    // cb到期时直接在所属线程上执行(不经过调度) -> 必须短小且不能阻塞 适合唤醒协程/取消事件
+    template <class F>
+    TimerHandle addInlineTimer(std::chrono::microseconds interval, F&& cb, std::chrono::microseconds slack = std::chrono::microseconds(0))
+    {
+        Timer* timer = allocTimer();
+        timer->m_fn.assign(std::forward<F>(cb));
+        return startTimer(timer, interval, slack);
+    }
 
-    // 拿到堆中最近的超时时间
+    // 以下三个只处理当前线程的分片
+    // 拿到最近的超时时间(毫秒 向上取整)
     uint64_t getNextTimer();
+    // 拿到最近的超时时间(微秒) -> 之后其他线程加入更早的timer时会唤醒本线程
+    uint64_t getNextTimerUs();
 
     // 取出所有超时定时器的回调函数
     void listExpiredCb(std::vector<std::function<void()>>& cbs);
 
-    // 堆中是否有timer
+    // 所有分片中是否还有未到期的timer
     bool hasTimer();
 
+    // 因slack与其他timer一起到期而省去的唤醒次数
+    uint64_t getAvoidedWakeups() const;
+
 protected:
-    // 当一个最早的timer加入到堆中 -> 调用该函数
-    virtual void onTimerInsertedAtFront() {};
+    // 其他线程向分片shard加入了比它等待的更早的timer -> 唤醒该分片的线程
+    virtual void onTimerInsertedAtFront(int /*shard*/) {}
 
-    // 添加timer
-    void addTimer(std::shared_ptr<Timer> timer);
+    // 当前线程的分片 -> -1表示不拥有分片 timer轮流交给各分片
+    // 默认所有线程都使用分片0 -> 单独使用TimerManager时由调用者保证串行
+    virtual int getTimerShard() {return 0;}
+
+    // 分片shard的所属线程已经在处理到期 -> 轮流分配时可以选它
+    // 否则在所属线程第一次取超时时间时才标记
+    void activateShard(int shard) {m_shards[shard]->active = true;}
 
 private:
-    // 当系统时间改变时 -> 调用该函数
-    bool detectClockRollover();
+    struct alignas(64) Shard
+    {
+        // 1 tick = 1us
+        TimerWheel wheel;
+        // 其他线程的请求 -> 无锁栈 所属线程一次全部取出
+        std::atomic<Timer*> inbox = {nullptr};
+        // 所属线程睡到的tick -> 0表示醒着 其他线程只为更早的timer唤醒它
+        std::atomic<uint64_t> sleepTick = {0};
+        // 所属线程在处理到期 -> 轮流分配时跳过其他分片(如stop()之前不调度的主线程)
+        std::atomic<bool> active = {false};
+        // 因slack省去的唤醒次数
+        std::atomic<uint64_t> avoidedWakeups = {0};
+        // 所属线程独占的对象池
+        TimerSlab slab;
+        // 不拥有分片的线程使用的对象池 -> 所属线程回收时同样加锁
+        TimerSlab remoteSlab;
+        std::mutex remoteMutex;
+    };
+
+    // 绝对时间 -> tick 向上取整 保证不会提前到期
+    uint64_t toTick(std::chrono::time_point<std::chrono::steady_clock> time) const;
+    uint64_t nowTick() const {return toTick(std::chrono::steady_clock::now());}
+    // [due, due + slack]中末尾0最多的tick -> 相近的timer落在同一个tick
+    static uint64_t coalesce(uint64_t due, uint64_t slack);
+
+    // timer的状态或m_due变化后调用 -> 所属线程直接处理 其他线程放入收件箱
+    void update(Timer* timer);
+    // 所属线程 按状态和m_due把timer放到正确的位置
+    void apply(Timer* timer);
+    // 所属线程 处理收件箱
+    void drainInbox(Shard& shard);
+    // 不拥有分片的线程 轮流选择一个分片
+    int pickShard();
+
+    // 从对象池取出一个timer 并选定分片
+    Timer* allocTimer();
+    TimerHandle startTimer(Timer* timer, std::chrono::microseconds interval, std::chrono::microseconds slack);
+    // 所属线程 对象池中的timer结束后放回对象池
+    void release(Timer* timer);
 
 private:
-    std::shared_mutex m_mutex;
-    // 时间堆
-    std::set<std::shared_ptr<Timer>, Timer::Comparator> m_timers;
-    // 在下次getNextTime()执行前 onTimerInsertedAtFront()是否已经被触发了 -> 在此过程中 onTimerInsertedAtFront()只执行一次
-    bool m_tickled = false;
-    // 上次检查系统时间是否回退的绝对时间
-    std::chrono::time_point<std::chrono::system_clock> m_previouseTime;
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    // tick 0对应的绝对时间
+    std::chrono::time_point<std::chrono::steady_clock> m_base;
+    // PENDING状态的timer数
+    std::atomic<size_t> m_count = {0};
+    // 不拥有分片的线程添加的timer轮流放入各分片
+    std::atomic<size_t> m_nextShard = {0};
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,180 @@
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cerrno>
+#include <cstring>
+
+#include "uring.h"
+
+namespace sylar {
+
+static int io_uring_setup(unsigned entries, io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+Uring::~Uring()
+{
+    if (m_sqes)
+    {
+        munmap(m_sqes, m_sqesSize);
+    }
+    if (m_ringPtr)
+    {
+        munmap(m_ringPtr, m_ringSize);
+    }
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
+bool Uring::init(unsigned entries)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_fd = io_uring_setup(entries, &p);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    // sq and cq share one mapping -> 5.4+
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    m_ringSize = sq_size > cq_size ? sq_size : cq_size;
+    m_ringPtr = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_ringPtr == MAP_FAILED)
+    {
+        m_ringPtr = nullptr;
+        return false;
+    }
+
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        return false;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* ring = (char*)m_ringPtr;
+    m_sqHead    = (unsigned*)(ring + p.sq_off.head);
+    m_sqTail    = (unsigned*)(ring + p.sq_off.tail);
+    m_sqMask    = (unsigned*)(ring + p.sq_off.ring_mask);
+    m_sqArray   = (unsigned*)(ring + p.sq_off.array);
+    m_sqEntries = p.sq_entries;
+
+    m_cqHead = (unsigned*)(ring + p.cq_off.head);
+    m_cqTail = (unsigned*)(ring + p.cq_off.tail);
+    m_cqMask = (unsigned*)(ring + p.cq_off.ring_mask);
+    m_cqes   = (io_uring_cqe*)(ring + p.cq_off.cqes);
+
+    m_cancelFd = probeCancelFd();
+    return true;
+}
+
+bool Uring::probeCancelFd()
+{
+    // cancel everything on the ring's own fd -> nothing matches
+    io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode       = IORING_OP_ASYNC_CANCEL;
+    sqe.fd           = m_fd;
+    sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    if (submit(sqe))
+    {
+        return false;
+    }
+
+    io_uring_cqe cqe;
+    while (reap(&cqe, 1) == 0)
+    {
+        if (io_uring_enter(m_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        {
+            return false;
+        }
+    }
+    // older kernels reject any cancel_flags
+    return cqe.res != -EINVAL;
+}
+
+int Uring::submit(const io_uring_sqe& sqe, const __kernel_timespec* timeout)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    unsigned count = timeout ? 2 : 1;
+    unsigned tail = *m_sqTail;
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqEntries - (tail - head) < count)
+    {
+        return -EBUSY;
+    }
+
+    unsigned index = tail & *m_sqMask;
+    m_sqes[index] = sqe;
+    m_sqArray[index] = index;
+
+    if (timeout)
+    {
+        // the timeout cancels the operation -> its own completion carries user_data 0
+        m_sqes[index].flags |= IOSQE_IO_LINK;
+
+        unsigned next = (tail + 1) & *m_sqMask;
+        io_uring_sqe& link = m_sqes[next];
+        memset(&link, 0, sizeof(link));
+        link.opcode    = IORING_OP_LINK_TIMEOUT;
+        link.fd        = -1;
+        link.addr      = (uint64_t)timeout;
+        link.len       = 1;
+        link.user_data = 0;
+        m_sqArray[next] = next;
+    }
+
+    __atomic_store_n(m_sqTail, tail + count, __ATOMIC_RELEASE);
+
+    // the kernel copies the sqes (and the timespec) before returning
+    // it refuses new work while its completion queue overflows -> queued sqes are retried by flush()
+    enter();
+    return 0;
+}
+
+void Uring::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    enter();
+}
+
+void Uring::enter()
+{
+    unsigned pending = *m_sqTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    while (pending > 0 && io_uring_enter(m_fd, pending, 0, 0) < 0 && errno == EINTR);
+}
+
+size_t Uring::reap(io_uring_cqe* cqes, size_t max)
+{
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    while (head != tail && n < max)
+    {
+        cqes[n++] = m_cqes[head & *m_cqMask];
+        ++head;
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+} // end namespace sylar
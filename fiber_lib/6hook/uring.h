@@ -0,0 +1,74 @@
+#ifndef __SYLAR_URING_H__
+#define __SYLAR_URING_H__
+
+#include <linux/io_uring.h>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+namespace sylar {
+
+// minimal io_uring on raw syscalls -> no liburing dependency
+// submit() may be called from any thread, reap() only from the owner
+class Uring
+{
+public:
+    Uring() = default;
+    ~Uring();
+
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    // false -> io_uring is not available (old kernel, seccomp, kernel.io_uring_disabled)
+    bool init(unsigned entries);
+
+    // ring fd -> readable when completions are pending
+    int getFd() const { return m_fd; }
+
+    // IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL is supported -> 5.19+, probed by init()
+    bool canCancelFd() const { return m_cancelFd; }
+
+    // copy sqe into the ring and submit it, timeout != nullptr -> linked timeout
+    // returns 0 or -EBUSY when the submission queue is full
+    int submit(const io_uring_sqe& sqe, const __kernel_timespec* timeout = nullptr);
+    // submit sqes left over by a failed io_uring_enter
+    void flush();
+
+    // pop at most max completions
+    size_t reap(io_uring_cqe* cqes, size_t max);
+
+private:
+    // no lock
+    void enter();
+    // submit a cancel by fd and wait for its completion
+    bool probeCancelFd();
+
+private:
+    int m_fd = -1;
+    bool m_cancelFd = false;
+
+    void* m_ringPtr = nullptr;
+    size_t m_ringSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    // submission queue
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned* m_sqMask = nullptr;
+    unsigned* m_sqArray = nullptr;
+    unsigned m_sqEntries = 0;
+
+    // completion queue
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned* m_cqMask = nullptr;
+    io_uring_cqe* m_cqes = nullptr;
+
+    // protect the submission queue
+    std::mutex m_mutex;
+};
+
+} // end namespace sylar
+
+#endif